@@ -0,0 +1,93 @@
+#!/bin/bash
+#
+# auth_test.sh - Check that the proxy never hands one user's response to
+#     another. A small origin echoes back the Authorization or Cookie it
+#     was sent, in a response that would otherwise be cached for a
+#     minute; requests with different credentials, one after the other
+#     and concurrently, must each see their own.
+#
+#     usage: ./auth_test.sh [proxy options, e.g. -e or -u]
+#
+
+TIMEOUT=5
+
+if [ ! -x ./proxy ]
+then
+    echo "Error: ./proxy not found or not an executable file. Please rebuild your proxy and try again."
+    exit 1
+fi
+
+origin_port=$((20000 + RANDOM % 20000))
+proxy_port=$((origin_port + 1))
+
+# Origin: the body names the credentials; /slow answers after a second so
+# that concurrent requests overlap
+python3 - ${origin_port} <<'EOF' &> /dev/null &
+import sys, time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+class Echo(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    def do_GET(self):
+        if self.path.startswith("/slow"):
+            time.sleep(1)
+        body = ("user=%s cookie=%s\n" % (self.headers.get("Authorization", ""),
+                                         self.headers.get("Cookie", ""))).encode()
+        self.send_response(200)
+        self.send_header("Cache-Control", "max-age=60")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+    def log_message(self, *args):
+        pass
+
+ThreadingHTTPServer(("", int(sys.argv[1])), Echo).serve_forever()
+EOF
+origin_pid=$!
+
+./proxy "$@" ${proxy_port} &> /dev/null &
+proxy_pid=$!
+sleep 1
+
+numRun=0
+numSucceeded=0
+
+# fetch <path> <header> - print the body the proxy returns
+function fetch {
+    curl --max-time ${TIMEOUT} --silent --proxy "http://localhost:${proxy_port}" \
+         ${2:+--header "$2"} "http://localhost:${origin_port}$1"
+}
+
+# expect <description> <body> <expected body>
+function expect {
+    numRun=`expr $numRun + 1`
+    if [ "$2" == "$3" ]; then
+        numSucceeded=`expr ${numSucceeded} + 1`
+        echo "   Success: $1"
+    else
+        echo "   Failure: $1 (got \"$2\", expected \"$3\")"
+    fi
+}
+
+echo "*** Credentials ***"
+expect "alice gets her response" "$(fetch /private 'Authorization: Basic alice')" "user=Basic alice cookie="
+expect "bob is not served alice's" "$(fetch /private 'Authorization: Basic bob')" "user=Basic bob cookie="
+expect "no credentials, no one else's response" "$(fetch /private)" "user= cookie="
+expect "carol gets her response" "$(fetch /cookie 'Cookie: id=carol')" "user= cookie=id=carol"
+expect "dave is not served carol's" "$(fetch /cookie 'Cookie: id=dave')" "user= cookie=id=dave"
+
+# Concurrent requests must not share one fetch either
+fetch /slow 'Authorization: Basic alice' > /tmp/auth_test.$$.a &
+a_pid=$!
+fetch /slow 'Authorization: Basic bob' > /tmp/auth_test.$$.b &
+b_pid=$!
+wait $a_pid $b_pid
+expect "concurrent alice" "$(cat /tmp/auth_test.$$.a)" "user=Basic alice cookie="
+expect "concurrent bob" "$(cat /tmp/auth_test.$$.b)" "user=Basic bob cookie="
+rm -f /tmp/auth_test.$$.a /tmp/auth_test.$$.b
+
+kill $proxy_pid $origin_pid 2> /dev/null
+wait $proxy_pid $origin_pid 2> /dev/null
+
+echo "credentialsScore: ${numSucceeded}/${numRun}"
+[ ${numSucceeded} -eq ${numRun} ]
@@ -1,110 +1,934 @@
-#include "csapp.h"
-
-// Define cache-related constants
-#define MAX_CACHE_SIZE 1049000  // Maximum cache size (in bytes) 1MB
-#define MAX_OBJECT_SIZE 102400  // Maximum size for an individual object (in bytes) 100kb
-
-// Cache block structure
-typedef struct {
-    char uri[MAXLINE];           // Key: URI of the request
-    char response[MAX_OBJECT_SIZE];  // Value: Server's response (binary data)
-    size_t size;                 // Size of the stored response
-    int lru_count;               // Least Recently Used count for eviction
-} cache_block;
-
-// Cache structure
-typedef struct {
-    cache_block *blocks;  // Pointer to dynamically allocated cache blocks
-    int cache_count;      // Number of cache entries currently in use
-    int lru_tracker;      // Track the least recently used entries
-} Cache;
+#include "cache.h"
 
 // Global cache variable
-Cache cache;
-
-/* Function Prototypes */
-void cache_init(Cache *cache);
-int cache_find(Cache *cache, char *uri, char *response, size_t *response_size);
-void cache_store(Cache *cache, char *uri, char *response, size_t size);
-void cache_evict(Cache *cache);
-
-/* Initialize the cache */
-void cache_init(Cache *cache) {
-    cache->cache_count = 0;  // Initialize the number of entries in the cache
-    cache->lru_tracker = 0;  // Initialize LRU tracker
-     cache.current_cache_size = 0;  // Initialize the total cache size to 0
-     
-    int num_entries = MAX_CACHE_SIZE / MAX_OBJECT_SIZE;  // Calculate the number of cache blocks we can have
-    cache.blocks = (cache_block *)malloc(sizeof(cache_block) * num_entries);
-    
-    if (cache.blocks == NULL) {
-        fprintf(stderr, "Cache initialization failed: insufficient memory\n");
-        exit(1);
-    }
-
-    // Initialize each cache block's size and LRU count
-    for (int i = 0; i < num_entries; i++) {
-        cache.blocks[i].size = 0;
-        cache.blocks[i].lru_count = 0;
-    }
-}
-
-/* Search for a URI in the cache */
-int cache_find(Cache *cache, char *uri, char *response, size_t *response_size) {
-    for (int i = 0; i < cache->cache_count; i++) {
-        if (strcmp(cache->blocks[i].uri, uri) == 0) {  // URI match
-            // Copy the cached binary response data into the output buffer
-            memcpy(response, cache->blocks[i].response, cache->blocks[i].size);
-            *response_size = cache->blocks[i].size;  // Return the size of the cached response
-            cache->blocks[i].lru_count = ++cache->lru_tracker;  // Update LRU count
-            return 1;  // Cache hit
-        }
+static Cache cache;
+
+// Odd multipliers that give each sketch row its own hash of the URI hash
+static const unsigned int sketch_seeds[CACHE_SKETCH_DEPTH] = {
+    0x9e3779b1u, 0x85ebca77u, 0xc2b2ae3du, 0x27d4eb2fu
+};
+
+static cache_shard *shard_for(unsigned int hash);
+static cache_block *new_block(char *uri, size_t local_size);
+static int insert_block(cache_block *block);
+static void free_block(cache_block *block);
+static void evict_block(cache_shard *s, cache_block *block, int replaced);
+static int fresh(cache_block *block);
+static int index_find(cache_shard *s, unsigned int hash, const char *uri);
+static int index_find_block(cache_shard *s, cache_block *block);
+static void index_insert(cache_shard *s, cache_block *block);
+static void index_remove(cache_shard *s, int pos);
+static void index_grow(cache_shard *s);
+static void list_push(cache_shard *s, int n, cache_block *block);
+static void list_remove(cache_shard *s, cache_block *block);
+static void list_drop(cache_shard *s, cache_block *block, int replaced);
+static void list_hit(cache_shard *s, cache_block *block);
+static void lru_insert(cache_shard *s, cache_block *block);
+static cache_block *lru_victim(cache_shard *s);
+static void tinylfu_init(cache_shard *s);
+static void tinylfu_cleanup(cache_shard *s);
+static void tinylfu_access(cache_shard *s, unsigned int hash);
+static void tinylfu_insert(cache_shard *s, cache_block *block);
+static cache_block *tinylfu_victim(cache_shard *s);
+static void sketch_add(cache_sketch *sk, unsigned int hash);
+static unsigned int sketch_estimate(cache_sketch *sk, unsigned int hash);
+static void gdsf_init(cache_shard *s);
+static void gdsf_cleanup(cache_shard *s);
+static void gdsf_hit(cache_shard *s, cache_block *block);
+static void gdsf_bytes_hit(cache_shard *s, cache_block *block);
+static void gdsf_insert(cache_shard *s, cache_block *block);
+static void gdsf_bytes_insert(cache_shard *s, cache_block *block);
+static void gdsf_remove(cache_shard *s, cache_block *block, int replaced);
+static cache_block *gdsf_victim(cache_shard *s);
+static void arc_init(cache_shard *s);
+static void arc_cleanup(cache_shard *s);
+static void arc_hit(cache_shard *s, cache_block *block);
+static void arc_insert(cache_shard *s, cache_block *block);
+static void arc_remove(cache_shard *s, cache_block *block, int replaced);
+static cache_block *arc_victim(cache_shard *s);
+static void arc_stats(cache_shard *s, int n);
+static void *stats_reporter(void *vargp);
+
+// Policies selectable with proxy -p; the first is the default
+static const cache_policy policies[] = {
+    // Least recently used
+    {.name = "lru", .hit = list_hit, .insert = lru_insert, .remove = list_drop, .victim = lru_victim},
+    // W-TinyLFU: new objects enter a small LRU window, and leave it for the
+    // main LRU only by outscoring its victims in a frequency sketch
+    {.name = "tinylfu", .init = tinylfu_init, .cleanup = tinylfu_cleanup, .access = tinylfu_access,
+     .hit = list_hit, .insert = tinylfu_insert, .remove = list_drop, .victim = tinylfu_victim},
+    // GreedyDual-Size-Frequency with a cost of 1 per object: favors small
+    // objects, for the most hits per byte of cache
+    {.name = "gdsf", .init = gdsf_init, .cleanup = gdsf_cleanup, .hit = gdsf_hit,
+     .insert = gdsf_insert, .remove = gdsf_remove, .victim = gdsf_victim},
+    // GDSF with a cost of the object's size: frequency alone ranks objects,
+    // for the most origin bytes saved
+    {.name = "gdsf-bytes", .init = gdsf_init, .cleanup = gdsf_cleanup, .hit = gdsf_bytes_hit,
+     .insert = gdsf_bytes_insert, .remove = gdsf_remove, .victim = gdsf_victim},
+    // Adaptive Replacement Cache: blocks seen once (T1) and more than once
+    // (T2), split by a target that ghosts of recent evictions move
+    {.name = "arc", .init = arc_init, .cleanup = arc_cleanup, .hit = arc_hit, .insert = arc_insert,
+     .remove = arc_remove, .victim = arc_victim, .stats = arc_stats},
+};
+
+/* FNV-1a hash of a URI */
+unsigned int cache_hash(const char *uri) {
+    unsigned int hash = 2166136261u;
+    while (*uri) {
+        hash ^= (unsigned char)*uri++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Return the policy called name, or NULL if there is none */
+const cache_policy *cache_policy_by_name(const char *name) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+        if (!strcmp(name, policies[i].name))
+            return &policies[i];
+    return NULL;
+}
+
+/* Initialize the cache with a budget of max_cache_size bytes; entries are bounded only by bytes */
+void cache_init(size_t max_cache_size, const cache_policy *policy) {
+    // Split the cache into as many shards as it can afford while every
+    // shard still holds CACHE_SHARD_MIN_OBJECTS full-size objects
+    cache.max_cache_size = max_cache_size;
+    cache.policy = policy;
+    cache.shard_count = 1;
+    while (cache.shard_count < CACHE_MAX_SHARDS &&
+           max_cache_size / (cache.shard_count * 2) >= (size_t)CACHE_SHARD_MIN_OBJECTS * MAX_OBJECT_SIZE)
+        cache.shard_count *= 2;
+    cache.shards = (cache_shard *)Calloc(cache.shard_count, sizeof(cache_shard));
+
+    // Blocks come from the slab allocator; the largest class fits a
+    // maximum-size object under the longest possible URI
+    slab_init(sizeof(cache_block) + MAXLINE + MAX_OBJECT_SIZE);
+
+    for (int n = 0; n < cache.shard_count; n++) {
+        cache_shard *s = &cache.shards[n];
+        pthread_rwlock_init(&s->lock, NULL);
+        pthread_mutex_init(&s->lru_lock, NULL);
+        s->cache_count = 0;
+        s->current_cache_size = 0;  // Initialize the total cache size to 0
+        s->max_cache_size = max_cache_size / cache.shard_count;
+
+        // Start with a small index; it doubles whenever it gets half full
+        s->index_size = CACHE_INDEX_MIN;
+        s->index = (cache_slot *)Calloc(s->index_size, sizeof(cache_slot));
+        if (policy->init)
+            policy->init(s);
     }
-    return 0;  // Cache miss
 }
 
-/* Store a new response in the cache */
-void cache_store(Cache *cache, char *uri, char *response, size_t size) {
+/* Clean up cache memory */
+void cache_cleanup(void) {
+    for (int n = 0; n < cache.shard_count; n++) {
+        cache_shard *s = &cache.shards[n];
+        while (s->cache_count > 0)
+            cache_evict(s);
+        Free(s->index);
+        if (cache.policy->cleanup)
+            cache.policy->cleanup(s);
+        pthread_rwlock_destroy(&s->lock);
+        pthread_mutex_destroy(&s->lru_lock);
+    }
+    Free(cache.shards);
+}
+
+/*
+ * Search for a URI in the cache. On a hit, return the block with a reference
+ * held for the caller, who sends straight from the block, as cache_iov
+ * points out, and then calls cache_release. Returns NULL on a miss. A stale entry counts as a
+ * miss, but if stale is not NULL it is returned anyway with *stale set,
+ * so the caller can ask the origin whether it is still current.
+ */
+cache_block *cache_find(char *uri, int *stale) {
+    unsigned int hash = cache_hash(uri);
+    cache_shard *s = shard_for(hash);
+
+    pthread_rwlock_rdlock(&s->lock);
+    if (cache.policy->access)
+        cache.policy->access(s, hash);
+    int pos = index_find(s, hash, uri);
+    if (pos < 0 || (!fresh(s->index[pos].block) && !stale)) {
+        __atomic_add_fetch(&s->misses, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_unlock(&s->lock);
+        return NULL;  // Cache miss
+    }
+
+    cache_block *block = s->index[pos].block;
+    __atomic_add_fetch(&block->refcnt, 1, __ATOMIC_RELAXED);
+    if (stale && (*stale = !fresh(block))) {
+        __atomic_add_fetch(&s->misses, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_unlock(&s->lock);
+        return block;  // Stale: the caller revalidates it
+    }
+    __atomic_add_fetch(&s->hits, 1, __ATOMIC_RELAXED);
+
+    // Tell the policy, unless another reader is doing the same right now;
+    // then this hit goes unrecorded, which only makes the order approximate
+    if (pthread_mutex_trylock(&s->lru_lock) == 0) {
+        cache.policy->hit(s, block);
+        pthread_mutex_unlock(&s->lru_lock);
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return block;  // Cache hit
+}
+
+/* Drop a reference returned by cache_find or cache_refresh, freeing the block if the cache no longer has it */
+void cache_release(cache_block *block) {
+    if (__atomic_sub_fetch(&block->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    // Only a block evicted, or never stored, can lose its last reference
+    free_block(block);
+}
+
+/* Store a new response in the cache, to be served until expires */
+void cache_store(char *uri, char *response, size_t size, time_t expires) {
     if (size > MAX_OBJECT_SIZE) {
         printf("Object too large to cache\n");
         return;
     }
+    if (expires <= time(NULL))
+        return;
+
+    // Store the new entry in a chunk sized to fit it
+    cache_block *block = new_block(uri, size);
+    if (!block)
+        return;
+    memcpy(block->response, response, size);  // Store the response
+    block->expires = expires;
+    insert_block(block);
+    cache_release(block);  // Freed at once if the cache did not take it
+}
+
+/*
+ * Build a new entry for stale's URI out of head, the head_size bytes of
+ * its updated response head, and stale's body, which starts body_off
+ * bytes into its response. The body is not copied: the entry refers to
+ * the block that holds it, which stays allocated as long as the entry
+ * does. The entry replaces stale in the cache if it is fresh until
+ * expires, and is returned either way with a reference for the caller;
+ * NULL if no chunk fits the head.
+ */
+cache_block *cache_refresh(cache_block *stale, const char *head, size_t head_size, size_t body_off,
+                           time_t expires) {
+    cache_block *block = new_block(stale->uri, head_size);
+    if (!block)
+        return NULL;
+    memcpy(block->response, head, head_size);
+    block->size = head_size + stale->size - body_off;
+    block->expires = expires;
+
+    // Refer to the block that owns the body, never to one that refers on, so chains never form
+    if (body_off < stale->local_size) {
+        block->body = stale->response + body_off;
+        block->body_block = stale;
+    } else if (stale->body_block) {
+        block->body = stale->body + (body_off - stale->local_size);
+        block->body_block = stale->body_block;
+    }
+    if (block->body_block) {
+        __atomic_add_fetch(&block->body_block->refcnt, 1, __ATOMIC_RELAXED);
+        block->charge += block->body_block->chunk_size;
+    }
+
+    if (expires > time(NULL))
+        insert_block(block);
+    return block;
+}
+
+/*
+ * Point iov at the bytes of block's response from off on: at most two
+ * entries, the bytes held in block itself and the body it refers to.
+ * Returns the number of entries filled.
+ */
+int cache_iov(cache_block *block, size_t off, struct iovec *iov) {
+    int n = 0;
+
+    if (off < block->local_size) {
+        iov[n].iov_base = block->response + off;
+        iov[n++].iov_len = block->local_size - off;
+        off = block->local_size;
+    }
+    if (off < block->size) {
+        iov[n].iov_base = block->body + (off - block->local_size);
+        iov[n++].iov_len = block->size - off;
+    }
+    return n;
+}
+
+/* Evict the policy's next victim; caller holds s->lock for writing */
+void cache_evict(cache_shard *s) {
+    cache_block *block = cache.policy->victim(s);
+    if (block)
+        evict_block(s, block, 0);
+}
+
+/* Print the cache's totals, then any per-shard state of its policy */
+void cache_stats(void) {
+    unsigned long hits = 0, misses = 0;
+    size_t bytes = 0;
+    int entries = 0;
+
+    for (int n = 0; n < cache.shard_count; n++) {
+        cache_shard *s = &cache.shards[n];
+        pthread_rwlock_rdlock(&s->lock);
+        entries += s->cache_count;
+        bytes += s->current_cache_size;
+        pthread_rwlock_unlock(&s->lock);
+        hits += __atomic_load_n(&s->hits, __ATOMIC_RELAXED);
+        misses += __atomic_load_n(&s->misses, __ATOMIC_RELAXED);
+    }
+    printf("Cache stats: %s, %d entries, %zu of %zu bytes, %lu hits, %lu misses\n",
+           cache.policy->name, entries, bytes, cache.max_cache_size, hits, misses);
+
+    // The budget counts chunks; free chunks in partly used slab pages come on top
+    size_t held, used;
+    slab_stats(&held, &used);
+    printf("  slab: %zu bytes from malloc, %zu in chunks, %zu overhead\n", held, used,
+           held > used ? held - used : 0);
+
+    // Hits change the policy's state under lru_lock
+    for (int n = 0; cache.policy->stats && n < cache.shard_count; n++) {
+        cache_shard *s = &cache.shards[n];
+        pthread_rwlock_rdlock(&s->lock);
+        pthread_mutex_lock(&s->lru_lock);
+        cache.policy->stats(s, n);
+        pthread_mutex_unlock(&s->lru_lock);
+        pthread_rwlock_unlock(&s->lock);
+    }
+    fflush(stdout);
+}
+
+/* Report cache statistics every interval seconds from now on; 0 never does */
+void cache_stats_start(int interval) {
+    pthread_t tid;
+    if (interval > 0)
+        Pthread_create(&tid, NULL, stats_reporter, (void *)(long)interval);
+}
+
+static void *stats_reporter(void *vargp) {
+    int interval = (int)(long)vargp;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        Sleep(interval);
+        cache_stats();
+    }
+    return NULL;
+}
+
+/* Pick the shard for a hash; the index probes with the low bits, so use the upper ones */
+static cache_shard *shard_for(unsigned int hash) {
+    return &cache.shards[(hash >> 16) & (cache.shard_count - 1)];
+}
+
+/*
+ * Allocate a block for uri with room for local_size bytes of response in
+ * a chunk sized to fit them, holding a reference for the caller. Returns
+ * NULL if no chunk is that large.
+ */
+static cache_block *new_block(char *uri, size_t local_size) {
+    size_t uri_len = strlen(uri) + 1;
+    size_t chunk_size = slab_chunk_size(sizeof(cache_block) + uri_len + local_size);
+    if (chunk_size == 0)
+        return NULL;
+
+    cache_block *block = slab_alloc(sizeof(cache_block) + uri_len + local_size);
+    block->uri = block->data;
+    block->response = block->data + uri_len;
+    memcpy(block->uri, uri, uri_len);  // Store the URI
+    block->size = block->local_size = local_size;
+    block->body = NULL;
+    block->body_block = NULL;
+    block->chunk_size = block->charge = chunk_size;
+    block->hash = cache_hash(uri);
+    block->refcnt = 1;
+    return block;
+}
+
+/*
+ * Add a new block to its shard, replacing a stale entry for its URI.
+ * Another thread may have stored the same URI meanwhile; that copy is
+ * kept while it is fresh, and so is one the shard has no room for.
+ * Returns 1 if the cache took a reference to block.
+ */
+static int insert_block(cache_block *block) {
+    cache_shard *s = shard_for(block->hash);
+    if (block->charge > s->max_cache_size)
+        return 0;
+
+    pthread_rwlock_wrlock(&s->lock);
+    int pos = index_find(s, block->hash, block->uri);
+    if (pos >= 0 && fresh(s->index[pos].block)) {
+        pthread_rwlock_unlock(&s->lock);
+        return 0;
+    }
+    if (pos >= 0)
+        evict_block(s, s->index[pos].block, 1);
+
+    block->refcnt++;  // The cache's own reference; no other thread has the block yet
+    index_insert(s, block);
+
+    // Update the total cache size
+    s->current_cache_size += block->charge;
+
+    // Increment the cache count
+    s->cache_count++;
+
+    // Let the policy place the block, then evict its victims until the shard fits its budget
+    cache.policy->insert(s, block);
+    while (s->current_cache_size > s->max_cache_size)
+        cache_evict(s);
+    pthread_rwlock_unlock(&s->lock);
+    return 1;
+}
+
+/* Give an unreferenced block's chunk back to the slab, and let go of the block holding its body */
+static void free_block(cache_block *block) {
+    cache_block *body_block = block->body_block;
+
+    slab_free(block, block->chunk_size);
+    if (body_block)
+        cache_release(body_block);
+}
+
+/* Is block still fresh? Stale blocks stay indexed until revalidated or replaced */
+static int fresh(cache_block *block) {
+    return block->expires > time(NULL);
+}
+
+/*
+ * Remove block from the shard, evicted or, if replaced is set, giving
+ * way to a new copy of its URI; caller holds s->lock for writing
+ */
+static void evict_block(cache_shard *s, cache_block *block, int replaced) {
+    printf("%s cache entry: %s\n", replaced ? "Replacing" : "Evicting", block->uri);
+    index_remove(s, index_find_block(s, block));
+    cache.policy->remove(s, block, replaced);
+
+    // Update the total cache size
+    s->current_cache_size -= block->charge;
+
+    // Decrease the cache count
+    s->cache_count--;
+
+    // Drop the cache's reference; readers still sending it keep it alive
+    if (__atomic_sub_fetch(&block->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+        free_block(block);
+}
+
+/* Return the index slot holding uri, or -1 if it is not cached */
+static int index_find(cache_shard *s, unsigned int hash, const char *uri) {
+    unsigned int mask = s->index_size - 1;
+
+    for (unsigned int i = hash & mask; s->index[i].block; i = (i + 1) & mask) {
+        // Only dereference the block when the full hash already matches
+        if (s->index[i].hash == hash && strcmp(s->index[i].block->uri, uri) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* Return the index slot that points at block */
+static int index_find_block(cache_shard *s, cache_block *block) {
+    unsigned int mask = s->index_size - 1;
+    unsigned int i;
+
+    for (i = block->hash & mask; s->index[i].block != block; i = (i + 1) & mask)
+        ;
+    return i;
+}
+
+/* Add block to the index, growing it to keep the load factor at most 1/2 */
+static void index_insert(cache_shard *s, cache_block *block) {
+    if ((s->cache_count + 1) * 2 > s->index_size)
+        index_grow(s);
+
+    unsigned int mask = s->index_size - 1;
+    unsigned int i;
+    for (i = block->hash & mask; s->index[i].block; i = (i + 1) & mask)
+        ;
+    s->index[i].hash = block->hash;
+    s->index[i].block = block;
+}
+
+/* Delete slot pos, shifting later members of its probe run back (no tombstones) */
+static void index_remove(cache_shard *s, int pos) {
+    unsigned int mask = s->index_size - 1;
+    unsigned int hole = pos, i = pos;
+
+    while (1) {
+        i = (i + 1) & mask;
+        if (!s->index[i].block)
+            break;
+        unsigned int home = s->index[i].hash & mask;
+        // Move slot i into the hole unless its home lies cyclically in (hole, i]
+        if ((i > hole && (home <= hole || home > i)) ||
+            (i < hole && (home <= hole && home > i))) {
+            s->index[hole] = s->index[i];
+            hole = i;
+        }
+    }
+    s->index[hole].block = NULL;
+}
+
+/* Double the index and rehash every occupied slot */
+static void index_grow(cache_shard *s) {
+    cache_slot *old = s->index;
+    int old_size = s->index_size;
+
+    s->index_size *= 2;
+    s->index = (cache_slot *)Calloc(s->index_size, sizeof(cache_slot));
+
+    unsigned int mask = s->index_size - 1;
+    for (int j = 0; j < old_size; j++) {
+        if (!old[j].block)
+            continue;
+        unsigned int i;
+        for (i = old[j].hash & mask; s->index[i].block; i = (i + 1) & mask)
+            ;
+        s->index[i] = old[j];
+    }
+    Free(old);
+}
+
+/* Insert block at the most recently used end of list n */
+static void list_push(cache_shard *s, int n, cache_block *block) {
+    cache_list *list = &s->lists[n];
+
+    block->list = n;
+    block->prev = NULL;
+    block->next = list->head;
+    if (list->head)
+        list->head->prev = block;
+    else
+        list->tail = block;
+    list->head = block;
+    s->list_size[n] += block->charge;
+}
+
+/* Detach block from whichever list holds it */
+static void list_remove(cache_shard *s, cache_block *block) {
+    cache_list *list = &s->lists[block->list];
+
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        list->head = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    else
+        list->tail = block->prev;
+    block->prev = block->next = NULL;
+    s->list_size[block->list] -= block->charge;
+}
+
+/* The list policies' remove: the lists keep no trace of what left them */
+static void list_drop(cache_shard *s, cache_block *block, int replaced) {
+    list_remove(s, block);
+}
+
+/* Move a block that was just used to the most recently used end of its list */
+static void list_hit(cache_shard *s, cache_block *block) {
+    list_remove(s, block);
+    list_push(s, block->list, block);
+}
+
+/*
+ * LRU: one list, evicted from the least recently used end
+ */
+
+static void lru_insert(cache_shard *s, cache_block *block) {
+    list_push(s, 0, block);
+}
+
+static cache_block *lru_victim(cache_shard *s) {
+    return s->lists[0].tail;
+}
+
+/*
+ * W-TinyLFU: a count-min sketch estimates how often each URI was looked
+ * up lately, misses included. New objects always enter the window list;
+ * an object pushed out of it joins the main list only while the sketch
+ * rates it above each victim it would displace.
+ */
+
+#define TINYLFU_MAIN 0
+#define TINYLFU_WINDOW 1
+
+static void tinylfu_init(cache_shard *s) {
+    size_t largest = slab_chunk_size(sizeof(cache_block) + MAXLINE + MAX_OBJECT_SIZE);
+
+    // The window holds at least one full-size object, so anything
+    // cacheable can be asked for again before it must win admission
+    s->max_window_size = s->max_cache_size / 100 * CACHE_WINDOW_PERCENT;
+    if (s->max_window_size < largest)
+        s->max_window_size = largest;
+    if (s->max_window_size > s->max_cache_size / 2)
+        s->max_window_size = s->max_cache_size / 2;
+
+    // Rows wide enough for the objects the shard can hold
+    cache_sketch *sk = &s->sketch;
+    sk->width = 256;
+    while (sk->width < s->max_cache_size / CACHE_SKETCH_BYTES)
+        sk->width *= 2;
+    sk->counters = Calloc((size_t)CACHE_SKETCH_DEPTH * sk->width, 1);
+    sk->additions = 0;
+    sk->sample_size = CACHE_SKETCH_SAMPLE * sk->width;
+}
+
+static void tinylfu_cleanup(cache_shard *s) {
+    Free(s->sketch.counters);
+}
+
+static void tinylfu_access(cache_shard *s, unsigned int hash) {
+    sketch_add(&s->sketch, hash);
+}
+
+static void tinylfu_insert(cache_shard *s, cache_block *block) {
+    list_push(s, TINYLFU_WINDOW, block);
+
+    while (s->list_size[TINYLFU_WINDOW] > s->max_window_size) {
+        cache_block *candidate = s->lists[TINYLFU_WINDOW].tail;
+        unsigned int frequency = sketch_estimate(&s->sketch, candidate->hash);
+
+        list_remove(s, candidate);
+        list_push(s, TINYLFU_MAIN, candidate);
+        while (s->current_cache_size > s->max_cache_size && s->lists[TINYLFU_MAIN].tail != candidate) {
+            cache_block *victim = s->lists[TINYLFU_MAIN].tail;
+            if (sketch_estimate(&s->sketch, victim->hash) >= frequency) {
+                evict_block(s, candidate, 0);
+                break;
+            }
+            evict_block(s, victim, 0);
+        }
+    }
+}
+
+/* The main list gives way while the window is below its share */
+static cache_block *tinylfu_victim(cache_shard *s) {
+    return s->lists[TINYLFU_MAIN].tail ? s->lists[TINYLFU_MAIN].tail : s->lists[TINYLFU_WINDOW].tail;
+}
+
+/* Counter for hash in one row of the sketch */
+static unsigned char *sketch_counter(cache_sketch *sk, unsigned int hash, int row) {
+    hash *= sketch_seeds[row];
+    hash ^= hash >> 16;
+    return &sk->counters[row * sk->width + (hash & (sk->width - 1))];
+}
+
+/*
+ * Count one lookup of hash. Every sample_size lookups all counters are
+ * halved, so popularity fades unless it is kept up.
+ */
+static void sketch_add(cache_sketch *sk, unsigned int hash) {
+    for (int row = 0; row < CACHE_SKETCH_DEPTH; row++) {
+        unsigned char *c = sketch_counter(sk, hash, row);
+        if (__atomic_load_n(c, __ATOMIC_RELAXED) < CACHE_SKETCH_MAX)
+            __atomic_add_fetch(c, 1, __ATOMIC_RELAXED);
+    }
+
+    // Exactly one lookup sees the count reach sample_size and ages the sketch
+    if (__atomic_add_fetch(&sk->additions, 1, __ATOMIC_RELAXED) != sk->sample_size)
+        return;
+    for (size_t i = 0; i < (size_t)CACHE_SKETCH_DEPTH * sk->width; i++)
+        __atomic_store_n(&sk->counters[i], __atomic_load_n(&sk->counters[i], __ATOMIC_RELAXED) >> 1,
+                         __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&sk->additions, sk->sample_size / 2, __ATOMIC_RELAXED);
+}
+
+/* Estimated lookups of hash: the least of its counters, since collisions only add */
+static unsigned int sketch_estimate(cache_sketch *sk, unsigned int hash) {
+    unsigned int min = CACHE_SKETCH_MAX;
+
+    for (int row = 0; row < CACHE_SKETCH_DEPTH; row++) {
+        unsigned int c = __atomic_load_n(sketch_counter(sk, hash, row), __ATOMIC_RELAXED);
+        if (c < min)
+            min = c;
+    }
+    return min;
+}
+
+/*
+ * GDSF: every block has priority L + frequency x cost / size, where L,
+ * the shard's inflation, is the priority of the last block evicted. The
+ * lowest priority goes first, so large or rarely used blocks leave early,
+ * and L rising with each eviction ages out blocks that stop being used.
+ * Blocks sit in a binary min-heap on priority.
+ */
+
+static void heap_swap(cache_shard *s, int i, int j) {
+    cache_block *t = s->heap[i];
+    s->heap[i] = s->heap[j];
+    s->heap[j] = t;
+    s->heap[i]->heap_pos = i;
+    s->heap[j]->heap_pos = j;
+}
+
+/* Restore heap order around position i after its priority changed */
+static void heap_fix(cache_shard *s, int i) {
+    while (i > 0 && s->heap[i]->priority < s->heap[(i - 1) / 2]->priority) {
+        heap_swap(s, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        int least = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < s->heap_count && s->heap[l]->priority < s->heap[least]->priority)
+            least = l;
+        if (r < s->heap_count && s->heap[r]->priority < s->heap[least]->priority)
+            least = r;
+        if (least == i)
+            return;
+        heap_swap(s, i, least);
+        i = least;
+    }
+}
+
+/* Recompute block's priority with the given cost, which is spread over its size */
+static void gdsf_prioritize(cache_shard *s, cache_block *block, double cost) {
+    block->priority = s->inflation + block->frequency * cost / block->charge;
+}
+
+static void gdsf_init(cache_shard *s) {
+    s->heap_size = CACHE_HEAP_MIN;
+    s->heap = Malloc(s->heap_size * sizeof(cache_block *));
+    s->heap_count = 0;
+    s->inflation = 0;
+}
+
+static void gdsf_cleanup(cache_shard *s) {
+    Free(s->heap);
+}
+
+static void gdsf_hit(cache_shard *s, cache_block *block) {
+    block->frequency++;
+    gdsf_prioritize(s, block, 1);
+    heap_fix(s, block->heap_pos);
+}
+
+static void gdsf_bytes_hit(cache_shard *s, cache_block *block) {
+    block->frequency++;
+    gdsf_prioritize(s, block, block->charge);
+    heap_fix(s, block->heap_pos);
+}
+
+static void gdsf_push(cache_shard *s, cache_block *block) {
+    if (s->heap_count == s->heap_size) {
+        s->heap_size *= 2;
+        s->heap = Realloc(s->heap, s->heap_size * sizeof(cache_block *));
+    }
+    block->heap_pos = s->heap_count++;
+    s->heap[block->heap_pos] = block;
+    heap_fix(s, block->heap_pos);
+}
+
+static void gdsf_insert(cache_shard *s, cache_block *block) {
+    block->frequency = 1;
+    gdsf_prioritize(s, block, 1);
+    gdsf_push(s, block);
+}
+
+static void gdsf_bytes_insert(cache_shard *s, cache_block *block) {
+    block->frequency = 1;
+    gdsf_prioritize(s, block, block->charge);
+    gdsf_push(s, block);
+}
+
+static void gdsf_remove(cache_shard *s, cache_block *block, int replaced) {
+    int i = block->heap_pos;
 
-    // Evict the least recently used cache entry if the cache is full
-    if (cache->cache_count >= MAX_CACHE_SIZE) {
-        cache_evict(cache);
+    if (i != --s->heap_count) {
+        heap_swap(s, i, s->heap_count);
+        heap_fix(s, i);
     }
+}
 
-    // Store the new entry in the next available cache block
-    strcpy(cache->blocks[cache->cache_count].uri, uri);  // Store the URI
-    memcpy(cache->blocks[cache->cache_count].response, response, size);  // Store the response
-    cache->blocks[cache->cache_count].size = size;  // Store the size
-    cache->blocks[cache->cache_count].lru_count = ++cache->lru_tracker;  // Update LRU count
-    cache->cache_count++;  // Increment cache count
+/* The lowest priority block, whose priority becomes the new inflation */
+static cache_block *gdsf_victim(cache_shard *s) {
+    if (s->heap_count == 0)
+        return NULL;
+    s->inflation = s->heap[0]->priority;
+    return s->heap[0];
 }
 
-/* Evict the least recently used cache block */
-void cache_evict(Cache *cache) {
-    if (cache->cache_count == 0) return;  // No need to evict if the cache is empty
+/*
+ * ARC: T1 holds blocks used once since they were stored, T2 blocks used
+ * again; the least recently used end of each is evicted. Evicted blocks
+ * leave ghosts, their URI hashes, on B1 and B2. A store that hits a B1
+ * ghost means T1 was too small, so its target p grows; a B2 ghost shrinks
+ * it. Sizes are in bytes rather than ARC's fixed pages: each adaptation
+ * moves p by the object's size, scaled by the ratio of the ghost lists.
+ */
+
+#define ARC_T1 0
+#define ARC_T2 1
+#define ARC_B1 0  // Ghosts of T1, evicted before being used again
+#define ARC_B2 1  // Ghosts of T2
 
-    int lru_index = 0;
-    int min_lru = cache->blocks[0].lru_count;
+static cache_ghost *ghost_find(cache_shard *s, unsigned int hash) {
+    cache_ghost *g;
 
-    // Find the block with the lowest LRU count (least recently used)
-    for (int i = 1; i < cache->cache_count; i++) {
-        if (cache->blocks[i].lru_count < min_lru) {
-            lru_index = i;
-            min_lru = cache->blocks[i].lru_count;
+    for (g = s->ghost_buckets[hash & (s->ghost_bucket_count - 1)]; g; g = g->chain)
+        if (g->hash == hash)
+            return g;
+    return NULL;
+}
+
+/* Double the ghost buckets and rechain every ghost */
+static void ghost_grow(cache_shard *s) {
+    cache_ghost **old = s->ghost_buckets;
+    int old_count = s->ghost_bucket_count;
+
+    s->ghost_bucket_count *= 2;
+    s->ghost_buckets = Calloc(s->ghost_bucket_count, sizeof(cache_ghost *));
+    for (int i = 0; i < old_count; i++) {
+        cache_ghost *g, *chain;
+        for (g = old[i]; g; g = chain) {
+            cache_ghost **bucket = &s->ghost_buckets[g->hash & (s->ghost_bucket_count - 1)];
+            chain = g->chain;
+            g->chain = *bucket;
+            *bucket = g;
         }
     }
+    Free(old);
+}
 
-    // Evict the block with the lowest LRU count
-    printf("Evicting cache entry: %s\n", cache->blocks[lru_index].uri);
+/* Remember a block evicted from list, at the most recent end of the matching ghost list */
+static void ghost_add(cache_shard *s, int list, unsigned int hash, size_t size) {
+    if (s->ghost_count + 1 > s->ghost_bucket_count)
+        ghost_grow(s);
+
+    cache_ghost *g = slab_alloc(sizeof(cache_ghost));
+    cache_ghost **bucket = &s->ghost_buckets[hash & (s->ghost_bucket_count - 1)];
+    g->hash = hash;
+    g->size = size;
+    g->list = list;
+    g->chain = *bucket;
+    *bucket = g;
+
+    g->prev = NULL;
+    g->next = s->ghost_head[list];
+    if (s->ghost_head[list])
+        s->ghost_head[list]->prev = g;
+    else
+        s->ghost_tail[list] = g;
+    s->ghost_head[list] = g;
+    s->ghost_size[list] += size;
+    s->ghost_count++;
+}
 
-    // Shift remaining cache blocks to remove the least used one
-    for (int i = lru_index; i < cache->cache_count - 1; i++) {
-        cache->blocks[i] = cache->blocks[i + 1];
+static void ghost_remove(cache_shard *s, cache_ghost *g) {
+    cache_ghost **link = &s->ghost_buckets[g->hash & (s->ghost_bucket_count - 1)];
+
+    while (*link != g)
+        link = &(*link)->chain;
+    *link = g->chain;
+
+    if (g->prev)
+        g->prev->next = g->next;
+    else
+        s->ghost_head[g->list] = g->next;
+    if (g->next)
+        g->next->prev = g->prev;
+    else
+        s->ghost_tail[g->list] = g->prev;
+    s->ghost_size[g->list] -= g->size;
+    s->ghost_count--;
+    slab_free(g, sizeof(cache_ghost));
+}
+
+/* Forget the oldest ghosts until T1 and B1 fit the budget, and everything fits twice the budget */
+static void ghost_trim(cache_shard *s) {
+    size_t c = s->max_cache_size;
+
+    while (s->ghost_tail[ARC_B1] && s->list_size[ARC_T1] + s->ghost_size[ARC_B1] > c)
+        ghost_remove(s, s->ghost_tail[ARC_B1]);
+    while (s->ghost_tail[ARC_B2] && s->list_size[ARC_T1] + s->list_size[ARC_T2] +
+                                    s->ghost_size[ARC_B1] + s->ghost_size[ARC_B2] > 2 * c)
+        ghost_remove(s, s->ghost_tail[ARC_B2]);
+}
+
+static void arc_init(cache_shard *s) {
+    s->arc_p = 0;
+    s->ghost_bucket_count = CACHE_GHOST_BUCKETS;
+    s->ghost_buckets = Calloc(s->ghost_bucket_count, sizeof(cache_ghost *));
+}
+
+static void arc_cleanup(cache_shard *s) {
+    for (int list = ARC_B1; list <= ARC_B2; list++)
+        while (s->ghost_tail[list])
+            ghost_remove(s, s->ghost_tail[list]);
+    Free(s->ghost_buckets);
+}
+
+/* Used again: the block belongs in T2 now */
+static void arc_hit(cache_shard *s, cache_block *block) {
+    list_remove(s, block);
+    list_push(s, ARC_T2, block);
+}
+
+static void arc_insert(cache_shard *s, cache_block *block) {
+    cache_ghost *g = ghost_find(s, block->hash);
+
+    s->arc_new = block;
+    s->arc_from_b2 = 0;
+    if (!g) {
+        list_push(s, ARC_T1, block);
+        ghost_trim(s);
+        return;
+    }
+
+    // Evicted too soon from T1 (B1) or T2 (B2): give that list more room
+    double b1 = s->ghost_size[ARC_B1], b2 = s->ghost_size[ARC_B2];
+    if (g->list == ARC_B1) {
+        size_t delta = block->charge * (b2 > b1 ? b2 / b1 : 1);
+        s->arc_p = s->arc_p + delta < s->max_cache_size ? s->arc_p + delta : s->max_cache_size;
+    } else {
+        size_t delta = block->charge * (b1 > b2 ? b1 / b2 : 1);
+        s->arc_p = s->arc_p > delta ? s->arc_p - delta : 0;
+        s->arc_from_b2 = 1;
     }
+    ghost_remove(s, g);
+    list_push(s, ARC_T2, block);
+    ghost_trim(s);
+}
+
+/*
+ * An evicted block leaves its ghost behind. A replaced one does not: its
+ * URI is stored again at once, and finding its own ghost would count a
+ * routine refresh as a ghost hit.
+ */
+static void arc_remove(cache_shard *s, cache_block *block, int replaced) {
+    int list = block->list;
+
+    if (block == s->arc_new)
+        s->arc_new = NULL;
+    list_remove(s, block);
+    if (replaced)
+        return;
+    ghost_add(s, list == ARC_T1 ? ARC_B1 : ARC_B2, block->hash, block->charge);
+    ghost_trim(s);
+}
+
+/* Evict from T1 while it is over its target p, otherwise from T2 */
+static cache_block *arc_victim(cache_shard *s) {
+    cache_block *t1 = s->lists[ARC_T1].tail, *t2 = s->lists[ARC_T2].tail;
+    size_t t1_size = s->list_size[ARC_T1];
+    int from_t1 = t1 && (!t2 || t1_size > s->arc_p || (s->arc_from_b2 && t1_size >= s->arc_p));
+    cache_block *victim = from_t1 ? t1 : t2;
+
+    // The block being stored goes only if nothing else is left
+    if (victim == s->arc_new && (from_t1 ? t2 : t1))
+        victim = from_t1 ? t2 : t1;
+    return victim;
+}
 
-    cache->cache_count--;  // Reduce cache count
+static void arc_stats(cache_shard *s, int n) {
+    printf("  shard %d: p %zu of %zu bytes; T1 %zu, T2 %zu, B1 %zu, B2 %zu bytes\n", n, s->arc_p,
+           s->max_cache_size, s->list_size[ARC_T1], s->list_size[ARC_T2],
+           s->ghost_size[ARC_B1], s->ghost_size[ARC_B2]);
 }
@@ -1,19 +1,156 @@
-#include <stdio.h>
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
 #include "csapp.h"
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+#include "slab.h"
 
-// Cache block structure
-typedef struct {
-    char uri[MAXLINE];          // Key: URI of the request
-    char response[MAX_OBJECT_SIZE];  // Value: Server's response
-    size_t size;                // Size of the stored response
-    int lru_count;              // Least Recently Used count for eviction
+// Define cache-related constants
+#define MAX_CACHE_SIZE 1049000  // Default cache size (in bytes) 1MB, overridden by proxy -c
+#define MAX_OBJECT_SIZE 102400  // Maximum size for an individual object (in bytes) 100kb
+#define CACHE_INDEX_MIN 16      // Initial number of hash index slots (power of two)
+#define CACHE_MAX_SHARDS 16     // Upper bound on the number of cache shards (power of two)
+#define CACHE_SHARD_MIN_OBJECTS 16  // Only add a shard if each one still holds this many max-size objects
+#define CACHE_WINDOW_PERCENT 1  // TinyLFU: share of a shard's budget that admits objects unconditionally
+#define CACHE_SKETCH_DEPTH 4    // TinyLFU: rows of the frequency sketch, each hashed differently
+#define CACHE_SKETCH_BYTES 1024 // TinyLFU: each sketch row has a counter per this many bytes of budget
+#define CACHE_SKETCH_MAX 15     // TinyLFU: sketch counters saturate here
+#define CACHE_SKETCH_SAMPLE 10  // TinyLFU: halve the counters after this many increments per counter in a row
+#define CACHE_LISTS 2           // Recency lists a policy may keep per shard
+#define CACHE_STATS_INTERVAL 0  // Seconds between cache statistics reports, overridden by proxy -s; 0 = none
+#define CACHE_HEAP_MIN 64       // GDSF: initial capacity of a shard's priority heap
+#define CACHE_GHOST_BUCKETS 64  // ARC: initial ghost hash buckets per shard (power of two)
+
+// Cache block structure: a header followed by the URI and response bytes,
+// all in one slab chunk sized to fit them. A block refreshed by a 304
+// holds only the updated head and refers to the body in the block it
+// replaced, so a refresh never copies the body.
+typedef struct cache_block {
+    char *uri;                   // Key: URI of the request (points into data)
+    char *response;              // Value: Server's response (binary data, points into data)
+    size_t size;                 // Size of the stored response
+    size_t local_size;           // Bytes of it at response; any rest is at body
+    char *body;                  // The last size - local_size bytes, in body_block's data
+    struct cache_block *body_block;  // Block that holds body, with a reference held; NULL if none
+    size_t chunk_size;           // Bytes of slab memory the block occupies
+    size_t charge;               // Bytes counted against the budget: chunk_size plus body_block's
+    unsigned int hash;           // Precomputed hash of uri
+    time_t expires;              // When the response goes stale; from then on it is only served once revalidated
+    int refcnt;                  // References: one for the cache while resident, one per reader
+    int list;                    // Which of the shard's lists holds the block, if the policy keeps lists
+    int heap_pos;                // GDSF: position in the shard's priority heap
+    unsigned int frequency;      // GDSF: lookups while resident, counting the store
+    double priority;             // GDSF: inflation when last touched + frequency x cost / size
+    struct cache_block *prev;    // List: toward the most recently used end
+    struct cache_block *next;    // List: toward the least recently used end
+    char data[];                 // uri, NUL, response
 } cache_block;
 
+// Doubly linked list of blocks in recency order
+typedef struct {
+    cache_block *head;           // Most recently used block
+    cache_block *tail;           // Least recently used block (next to evict)
+} cache_list;
+
+// Count-min sketch: an estimate of how often each URI hash was looked up
+// lately. Readers bump it concurrently with relaxed atomics, so it is
+// approximate, as a sketch is anyway.
+typedef struct {
+    unsigned char *counters;     // CACHE_SKETCH_DEPTH rows of width counters
+    unsigned int width;          // Counters per row (power of two)
+    unsigned int additions;      // Increments since the counters were last halved, roughly
+    unsigned int sample_size;    // Halve every counter once additions reaches this
+} cache_sketch;
+
+// ARC: a block evicted lately, remembered by its URI hash alone
+typedef struct cache_ghost {
+    unsigned int hash;           // Hash of the block's uri
+    size_t size;                 // Slab bytes the block held
+    int list;                    // Ghost list it is on: B1 or B2
+    struct cache_ghost *prev;    // Toward the most recently evicted end
+    struct cache_ghost *next;    // Toward the least recently evicted end
+    struct cache_ghost *chain;   // Next ghost in the same hash bucket
+} cache_ghost;
+
+// Hash index slot: the hash is kept inline so a probe can reject a key
+// without touching the cache block itself
+typedef struct {
+    unsigned int hash;           // Hash of the block's uri
+    cache_block *block;          // NULL if the slot is empty
+} cache_slot;
+
+// Cache shard: an independent cache over the URIs that hash to it.
+// Lookups hold lock for reading; store/evict hold it for writing. A hit
+// updates the policy's order under lru_lock, which is only ever
+// try-locked, so readers never wait on each other.
+typedef struct {
+    pthread_rwlock_t lock;        // Guards everything below
+    pthread_mutex_t lru_lock;     // Lets a reader update the policy's order
+    int cache_count;      // Number of cache entries currently in use
+    size_t current_cache_size;  // Slab bytes held by cached blocks, with the bodies they refer to
+    size_t max_cache_size;      // This shard's share of the cache's byte budget
+    unsigned long hits;   // Lookups that found their URI; bumped atomically under the read lock
+    unsigned long misses; // Lookups that did not
+    cache_list lists[CACHE_LISTS];   // Resident blocks in recency order, as the policy divides them
+    size_t list_size[CACHE_LISTS];   // Bytes charged to each list
+    size_t max_window_size;  // TinyLFU: the admission window's share of max_cache_size
+    cache_sketch sketch;  // TinyLFU: lookup frequencies
+    cache_block **heap;   // GDSF: min-heap of resident blocks by priority
+    int heap_count;       // GDSF: blocks in heap
+    int heap_size;        // GDSF: capacity of heap
+    double inflation;     // GDSF: priority of the last block evicted
+    size_t arc_p;         // ARC: target bytes for T1 (lists[0]); T2 (lists[1]) gets the rest
+    cache_ghost *ghost_head[CACHE_LISTS];  // ARC: B1 and B2, most recently evicted first
+    cache_ghost *ghost_tail[CACHE_LISTS];
+    size_t ghost_size[CACHE_LISTS];        // ARC: bytes the blocks of each ghost list held
+    cache_ghost **ghost_buckets;  // ARC: ghosts by hash
+    int ghost_bucket_count;       // ARC: power of two
+    int ghost_count;
+    cache_block *arc_new;  // ARC: block being stored; it is only evicted as a last resort
+    int arc_from_b2;       // ARC: ... and it was a B2 ghost
+    cache_slot *index;    // Open-addressing hash index over blocks (linear probing)
+    int index_size;       // Number of index slots (always a power of two)
+} cache_shard;
+
+// Eviction policy: how a shard orders its blocks and which one goes next.
+// access sees every lookup under the read lock, concurrently with other
+// readers; hit runs under lru_lock as well. The rest run under the write
+// lock. After insert, the shard evicts victims until it fits its budget.
+// remove is told whether the block is replaced by a new copy of its own
+// URI rather than evicted. stats, if any, adds the policy's own state to
+// cache_stats.
+typedef struct {
+    const char *name;            // As given to proxy -p
+    void (*init)(cache_shard *s);
+    void (*cleanup)(cache_shard *s);
+    void (*access)(cache_shard *s, unsigned int hash);  // Optional
+    void (*hit)(cache_shard *s, cache_block *block);
+    void (*insert)(cache_shard *s, cache_block *block);
+    void (*remove)(cache_shard *s, cache_block *block, int replaced);
+    cache_block *(*victim)(cache_shard *s);
+    void (*stats)(cache_shard *s, int n);  // Optional
+} cache_policy;
+
 // Cache structure
 typedef struct {
-    cache_block blocks[MAX_CACHE_SIZE];  // Cache entries
-    int cache_count;               // Number of cache entries
-    int lru_tracker;               // Track the least recently used entries
-} Cache;
\ No newline at end of file
+    cache_shard *shards;  // Shards, selected by the upper bits of the URI hash
+    int shard_count;      // Number of shards (power of two)
+    size_t max_cache_size;  // Byte budget for the whole cache
+    const cache_policy *policy;  // How shards choose what to keep
+} Cache;
+
+/* Function Prototypes */
+void cache_init(size_t max_cache_size, const cache_policy *policy);
+const cache_policy *cache_policy_by_name(const char *name);
+void cache_cleanup(void);
+cache_block *cache_find(char *uri, int *stale);
+void cache_release(cache_block *block);
+void cache_store(char *uri, char *response, size_t size, time_t expires);
+cache_block *cache_refresh(cache_block *stale, const char *head, size_t head_size, size_t body_off,
+                           time_t expires);
+int cache_iov(cache_block *block, size_t off, struct iovec *iov);
+void cache_evict(cache_shard *shard);
+void cache_stats(void);
+void cache_stats_start(int interval);
+unsigned int cache_hash(const char *uri);
+
+#endif /* __CACHE_H__ */
@@ -742,6 +742,8 @@ void V(sem_t *sem)
  * The Rio package - Robust I/O functions
  ****************************************/
 
+static ssize_t rio_fill(rio_t *rp);
+
 /*
  * rio_readn - Robustly read n bytes (unbuffered)
  */
@@ -793,6 +795,38 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write every byte iov describes (unbuffered) with
+ *     as few writev calls as possible. Partial writes advance iov in
+ *     place, so the caller's array is used up.
+ */
+/* $begin rio_writev */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t nwritten, total = 0;
+
+    while (iovcnt > 0) {
+	if ((nwritten = writev(fd, iov, iovcnt)) < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		continue;        /* and call writev() again */
+	    return -1;           /* errno set by writev() */
+	}
+	total += nwritten;
+	/* Skip the vectors that went out whole, then trim the partial one */
+	while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return total;
+}
+/* $end rio_writev */
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -806,16 +840,9 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 {
     int cnt;
-    while (rp->rio_cnt <= 0/*buf가 empty하면*/) {  /* Refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf)); 
-	if (rp->rio_cnt < 0) {
-	    if (errno != EINTR) /* Interrupted by sig handler return */
-		return -1;
-	}
-	else if (rp->rio_cnt == 0)  /* EOF */
-	    return 0;
-	else 
-	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
+    if (rp->rio_cnt <= 0/*buf가 empty하면*/) {  /* Refill if buf is empty */
+	if ((cnt = rio_fill(rp)) <= 0)
+	    return cnt; /* EOF or error */
     }
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
@@ -829,6 +856,28 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 }
 /* $end rio_read */
 
+/*
+ * rio_fill - Refill rp's empty internal buffer with one read(). Returns
+ *    the bytes read, 0 on EOF, -1 on error. Shared by rio_read and
+ *    rio_readlineb.
+ */
+/* $begin rio_fill */
+static ssize_t rio_fill(rio_t *rp)
+{
+    ssize_t n;
+
+    while ((n = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf))) < 0) {
+	if (errno != EINTR) { /* Interrupted by sig handler return */
+	    rp->rio_cnt = 0;
+	    return -1;
+	}
+    }
+    rp->rio_cnt = n;
+    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
+    return n;
+}
+/* $end rio_fill */
+
 /*
  * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
  */
@@ -871,29 +920,58 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) /*rio_t에서 data를 읽고 usrbuf에 저장*/
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { /*1부터 maxlen-1까지 */
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {/*c가 newline이면 break*/
-                n++; /*n++ -> \n도 읽은 byte로 count*/
-     		break;
-            }
-	} else if (rc == 0) { /*rio_read 가 0이면 EOF의미*/
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+    size_t n = 0, cnt;
+    char *nl, *bufp = usrbuf;
+    ssize_t rc;
+
+    while (n + 1 < maxlen) { /*최대 maxlen-1 byte*/
+        if (rp->rio_cnt <= 0 && (rc = rio_fill(rp)) <= 0) {
+	    if (rc < 0)
+		return -1;	  /* Error */
+	    break;    /* EOF; returns 0 if no data was read */
+	}
+	/* Copy through the next newline, or all that is buffered, in one go */
+	cnt = maxlen - 1 - n;
+	if (rp->rio_cnt < cnt)
+	    cnt = rp->rio_cnt;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1; /*\n도 읽은 byte로 count*/
+	memcpy(bufp + n, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	n += cnt;
+	if (nl)
+	    break;
     }
-    *bufp = 0;
-    return n-1;
+    if (maxlen > 0)
+	bufp[n] = 0;
+    return n;
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_fillmoreb - For callers that parse in place: slide the unread bytes
+ *     to the front of rp's buffer and read more after them. Returns the
+ *     bytes added, 0 on EOF or if the buffer is already full, -1 on error.
+ */
+/* $begin rio_fillmoreb */
+ssize_t rio_fillmoreb(rio_t *rp)
+{
+    ssize_t n;
+
+    if (rp->rio_cnt == RIO_BUFSIZE)
+	return 0;
+    memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+    rp->rio_bufptr = rp->rio_buf;
+    while ((n = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt, RIO_BUFSIZE - rp->rio_cnt)) < 0) {
+	if (errno != EINTR)
+	    return -1;
+    }
+    rp->rio_cnt += n;
+    return n;
+}
+/* $end rio_fillmoreb */
+
 /*
 *rio_readnb: Best for reading binary data or fixed-size data, such as file contents, 
 *where you know exactly how many bytes to read. Examples include downloading a file or reading 
@@ -1053,6 +1131,64 @@ int open_listenfd(char *port)
 }
 /* $end open_listenfd */
 
+/*
+ * open_reuseport_listenfd - Like open_listenfd, but sets SO_REUSEPORT so
+ *     that several sockets can listen on the same port. The kernel then
+ *     spreads incoming connections across them, one accept queue each.
+ *
+ *     On error, returns:
+ *       -2 for getaddrinfo error
+ *       -1 with errno set for other errors.
+ */
+int open_reuseport_listenfd(char *port)
+{
+    struct addrinfo hints, *listp, *p;
+    int listenfd, rc, optval=1;
+
+    /* Get a list of potential server addresses */
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;             /* Accept connections */
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG; /* ... on any IP address */
+    hints.ai_flags |= AI_NUMERICSERV;            /* ... using port number */
+    if ((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0) {
+        fprintf(stderr, "getaddrinfo failed (port %s): %s\n", port, gai_strerror(rc));
+        return -2;
+    }
+
+    /* Walk the list for one that we can bind to */
+    for (p = listp; p; p = p->ai_next) {
+        /* Create a socket descriptor */
+        if ((listenfd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol)) < 0)
+            continue;  /* Socket failed, try the next */
+
+        /* Share the port with the other listeners */
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+                   (const void *)&optval , sizeof(int));
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                   (const void *)&optval , sizeof(int));
+
+        /* Bind the descriptor to the address */
+        if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
+            break; /* Success */
+        if (close(listenfd) < 0) { /* Bind failed, try the next */
+            fprintf(stderr, "open_reuseport_listenfd close failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    /* Clean up */
+    freeaddrinfo(listp);
+    if (!p) /* No address worked */
+        return -1;
+
+    /* Make it a listening socket ready to accept connection requests */
+    if (listen(listenfd, LISTENQ) < 0) {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
  ****************************************************/
@@ -1074,4 +1210,13 @@ int Open_listenfd(char *port)
     return rc;
 }
 
+int Open_reuseport_listenfd(char *port)
+{
+    int rc;
+
+    if ((rc = open_reuseport_listenfd(port)) < 0)
+	unix_error("Open_reuseport_listenfd error");
+    return rc;
+}
+
 /* $end csapp.c */
\ No newline at end of file
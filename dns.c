@@ -0,0 +1,220 @@
+/*
+ * dns.c - Cache of getaddrinfo results keyed by (hostname, port), so
+ *     repeat misses to an origin skip the resolver. getaddrinfo does not
+ *     report record TTLs, so answers are reused for DNS_TTL seconds and
+ *     names that do not resolve are remembered for DNS_NEGATIVE_TTL.
+ *     Lookups share a read lock; the resolver runs with no lock held.
+ *
+ *     getaddrinfo blocks, so event loops must not call it. They submit a
+ *     dns_query instead: cache hits are answered on the spot, and misses
+ *     go to a small pool of resolver threads that post the query's notice
+ *     back to the loop once it is answered.
+ */
+#include "dns.h"
+#include "cache.h"
+
+static dns_entry *buckets[DNS_BUCKETS];
+static int entry_count;
+static pthread_rwlock_t dns_lock = PTHREAD_RWLOCK_INITIALIZER;  // Guards buckets and entry_count
+
+// Queries waiting for a resolver thread, oldest first
+static dns_query *pending_head, *pending_tail;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+
+static dns_entry **bucket_for(char *hostname, char *port);
+static int lookup(dns_entry **bucket, char *hostname, char *port, dns_addr *addrs, int *count, int *error);
+static int resolve(char *hostname, char *port, dns_entry *entry);
+static void insert(dns_entry **bucket, dns_entry *entry, time_t now);
+static void *resolver(void *vargp);
+
+/* Start the resolver threads */
+void dns_init(void) {
+    pthread_t tid;
+    for (int i = 0; i < DNS_THREADS; i++)
+        Pthread_create(&tid, NULL, resolver, NULL);
+}
+
+/*
+ * Resolve hostname:port into addrs, which has room for DNS_MAX_ADDRS,
+ * and set *count. Returns 0 or the getaddrinfo error. Answers, and
+ * definite failures, come from the cache while they are fresh.
+ */
+int dns_resolve(char *hostname, char *port, dns_addr *addrs, int *count) {
+    dns_entry **bucket = bucket_for(hostname, port), *entry, answer;
+    time_t now = time(NULL);
+    int error;
+
+    if (lookup(bucket, hostname, port, addrs, count, &error))
+        return error;
+
+    resolve(hostname, port, &answer);
+    *count = answer.count;
+    memcpy(addrs, answer.addrs, answer.count * sizeof(dns_addr));
+
+    // Temporary failures (EAI_AGAIN and the like) are retried next time
+    if (answer.error == 0 || answer.error == EAI_NONAME || answer.error == EAI_FAIL) {
+        entry = Malloc(sizeof(dns_entry));
+        *entry = answer;
+        entry->expires = now + (answer.error ? DNS_NEGATIVE_TTL : DNS_TTL);
+        pthread_rwlock_wrlock(&dns_lock);
+        insert(bucket, entry, now);
+        pthread_rwlock_unlock(&dns_lock);
+    }
+    return answer.error;
+}
+
+/*
+ * Answer q from the cache and return 1 if possible; otherwise queue it
+ * for the resolver threads, which post q->notice once it is answered.
+ */
+int dns_resolve_async(dns_query *q) {
+    if (lookup(bucket_for(q->hostname, q->port), q->hostname, q->port, q->addrs, &q->count, &q->error))
+        return 1;
+
+    q->next = NULL;
+    pthread_mutex_lock(&pending_lock);
+    if (pending_tail)
+        pending_tail->next = q;
+    else
+        pending_head = q;
+    pending_tail = q;
+    pthread_cond_signal(&pending_cond);
+    pthread_mutex_unlock(&pending_lock);
+    return 0;
+}
+
+/* Drop the cached answer for hostname:port, e.g. once none of its addresses accept */
+void dns_forget(char *hostname, char *port) {
+    dns_entry **bucket = bucket_for(hostname, port), **link, *entry;
+
+    pthread_rwlock_wrlock(&dns_lock);
+    for (link = bucket; (entry = *link) != NULL; link = &entry->next) {
+        if (!strcmp(entry->hostname, hostname) && !strcmp(entry->port, port)) {
+            *link = entry->next;
+            Free(entry);
+            entry_count--;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&dns_lock);
+}
+
+/*
+ * open_clientfd through the cache. Returns a connected socket, -2 if
+ * the name does not resolve, or -1 if no address accepts a connection.
+ */
+int dns_open_clientfd(char *hostname, char *port) {
+    dns_addr addrs[DNS_MAX_ADDRS];
+    int count, fd, rc;
+
+    if ((rc = dns_resolve(hostname, port, addrs, &count)) != 0) {
+        fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", hostname, port, gai_strerror(rc));
+        return -2;
+    }
+    for (int i = 0; i < count; i++) {
+        if ((fd = socket(addrs[i].family, addrs[i].socktype | SOCK_CLOEXEC, addrs[i].protocol)) < 0)
+            continue;
+        if (connect(fd, (SA *)&addrs[i].addr, addrs[i].addrlen) == 0)
+            return fd;
+        close(fd);
+    }
+
+    // The origin may have moved; look it up afresh next time
+    dns_forget(hostname, port);
+    return -1;
+}
+
+static dns_entry **bucket_for(char *hostname, char *port) {
+    char key[NI_MAXHOST + NI_MAXSERV + 1];
+
+    snprintf(key, sizeof(key), "%s:%s", hostname, port);
+    return &buckets[cache_hash(key) & (DNS_BUCKETS - 1)];
+}
+
+/* Copy out a fresh cached answer for hostname:port; returns 0 on a miss */
+static int lookup(dns_entry **bucket, char *hostname, char *port, dns_addr *addrs, int *count, int *error) {
+    dns_entry *entry;
+    time_t now = time(NULL);
+
+    pthread_rwlock_rdlock(&dns_lock);
+    for (entry = *bucket; entry; entry = entry->next) {
+        if (entry->expires > now && !strcmp(entry->hostname, hostname) && !strcmp(entry->port, port)) {
+            *count = entry->count;
+            *error = entry->error;
+            memcpy(addrs, entry->addrs, entry->count * sizeof(dns_addr));
+            pthread_rwlock_unlock(&dns_lock);
+            return 1;
+        }
+    }
+    pthread_rwlock_unlock(&dns_lock);
+    return 0;
+}
+
+/* Ask the resolver; fills in everything but entry->expires */
+static int resolve(char *hostname, char *port, dns_entry *entry) {
+    struct addrinfo hints, *list, *p;
+
+    snprintf(entry->hostname, sizeof(entry->hostname), "%s", hostname);
+    snprintf(entry->port, sizeof(entry->port), "%s", port);
+    entry->count = 0;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    if ((entry->error = getaddrinfo(hostname, port, &hints, &list)) != 0)
+        return entry->error;
+
+    for (p = list; p && entry->count < DNS_MAX_ADDRS; p = p->ai_next) {
+        dns_addr *a = &entry->addrs[entry->count++];
+        a->family = p->ai_family;
+        a->socktype = p->ai_socktype;
+        a->protocol = p->ai_protocol;
+        a->addrlen = p->ai_addrlen;
+        memcpy(&a->addr, p->ai_addr, p->ai_addrlen);
+    }
+    freeaddrinfo(list);
+    return 0;
+}
+
+/* Add entry to bucket, replacing any older answer for its name; caller holds the write lock */
+static void insert(dns_entry **bucket, dns_entry *entry, time_t now) {
+    dns_entry **link = bucket, *old;
+
+    // Sweep out the stale entries the lookup walked past
+    while ((old = *link) != NULL) {
+        if (old->expires <= now || (!strcmp(old->hostname, entry->hostname) && !strcmp(old->port, entry->port))) {
+            *link = old->next;
+            Free(old);
+            entry_count--;
+        } else {
+            link = &old->next;
+        }
+    }
+
+    if (entry_count >= DNS_MAX_ENTRIES) {
+        Free(entry);  // Full of live entries; serve this answer uncached
+        return;
+    }
+    entry->next = *bucket;
+    *bucket = entry;
+    entry_count++;
+}
+
+/* Resolver thread routine: answer queued queries and wake the loops that asked */
+static void *resolver(void *vargp) {
+    Pthread_detach(pthread_self());
+    while (1) {
+        pthread_mutex_lock(&pending_lock);
+        while (!pending_head)
+            pthread_cond_wait(&pending_cond, &pending_lock);
+        dns_query *q = pending_head;
+        if ((pending_head = q->next) == NULL)
+            pending_tail = NULL;
+        pthread_mutex_unlock(&pending_lock);
+
+        q->error = dns_resolve(q->hostname, q->port, q->addrs, &q->count);
+        notice_post(q->notice);
+    }
+    return NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef __DNS_H__
+#define __DNS_H__
+
+#include "csapp.h"
+#include "notify.h"
+
+#define DNS_BUCKETS 256        // Hash buckets of cached names (power of two)
+#define DNS_MAX_ENTRIES 4096   // Cached (host, port) pairs, including failures
+#define DNS_MAX_ADDRS 8        // Addresses kept per name
+#define DNS_TTL 60             // Seconds a successful lookup is reused
+#define DNS_NEGATIVE_TTL 10    // Seconds a name that does not resolve is remembered
+#define DNS_THREADS 4          // Resolver threads answering event loop lookups
+
+// One resolved address, self-contained so it can be copied out of the cache
+typedef struct {
+    int family, socktype, protocol;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+} dns_addr;
+
+// Result of resolving hostname:port, positive or negative
+typedef struct dns_entry {
+    char hostname[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    time_t expires;
+    int error;                    // 0, or the getaddrinfo error being cached
+    int count;
+    dns_addr addrs[DNS_MAX_ADDRS];
+    struct dns_entry *next;       // Next entry in the same bucket
+} dns_entry;
+
+// Lookup handed to the resolver threads by an event loop
+typedef struct dns_query {
+    char *hostname, *port;        // Name to resolve; must outlive the query
+    dns_addr *addrs;              // Room for DNS_MAX_ADDRS answers
+    int count, error;             // Result, as from dns_resolve
+    notice *notice;               // Posted once a queued query is answered
+    struct dns_query *next;       // Link in the pending list
+} dns_query;
+
+/* Function Prototypes */
+void dns_init(void);
+int dns_resolve_async(dns_query *q);
+int dns_resolve(char *hostname, char *port, dns_addr *addrs, int *count);
+void dns_forget(char *hostname, char *port);
+int dns_open_clientfd(char *hostname, char *port);
+
+#endif /* __DNS_H__ */
@@ -0,0 +1,140 @@
+/*
+ * flight.c - Table of origin fetches in progress, keyed by URI, so that
+ *     concurrent misses on one URI cost the origin a single request. The
+ *     first miss leads the fetch, reading the response into the flight's
+ *     buffer; later ones follow it and relay each part of the response as
+ *     soon as the leader publishes it, rather than waiting for the whole
+ *     object to reach the cache. A response the cache would not keep is
+ *     never published, and its followers fetch it themselves.
+ */
+#include "flight.h"
+#include "cache.h"
+
+static flight *buckets[FLIGHT_BUCKETS];
+static pthread_mutex_t flight_lock = PTHREAD_MUTEX_INITIALIZER;  // Guards buckets and every flight
+
+static void wake(flight *f);
+static void put(flight *f);
+
+/*
+ * Join the fetch of uri, starting one if none is in progress. Sets
+ * *leader if the caller started it: the leader fills f->data, publishes
+ * it and lands f. Everyone calls flight_release when done with f.
+ */
+flight *flight_join(char *uri, int *leader) {
+    unsigned int hash = cache_hash(uri);
+    flight **bucket = &buckets[hash & (FLIGHT_BUCKETS - 1)], *f;
+
+    pthread_mutex_lock(&flight_lock);
+    for (f = *bucket; f; f = f->next) {
+        if (f->hash == hash && !strcmp(f->uri, uri)) {
+            f->refcnt++;
+            pthread_mutex_unlock(&flight_lock);
+            *leader = 0;
+            return f;
+        }
+    }
+
+    f = Malloc(sizeof(flight));
+    f->uri = Malloc(strlen(uri) + 1);
+    strcpy(f->uri, uri);
+    f->hash = hash;
+    f->refcnt = 1;
+    f->data = Malloc(MAX_OBJECT_SIZE);
+    f->size = 0;
+    f->landed = f->complete = 0;
+    pthread_cond_init(&f->cond, NULL);
+    f->waiters = NULL;
+    f->next = *bucket;
+    *bucket = f;
+    pthread_mutex_unlock(&flight_lock);
+    *leader = 1;
+    return f;
+}
+
+/* Leader: the first size bytes of f->data are final; let the followers have them */
+void flight_publish(flight *f, size_t size) {
+    pthread_mutex_lock(&flight_lock);
+    if (size > f->size) {
+        f->size = size;
+        wake(f);
+    }
+    pthread_mutex_unlock(&flight_lock);
+}
+
+/*
+ * Leader: stop filling f, with the whole response published if complete.
+ * Followers that get nothing from an incomplete flight fetch for themselves.
+ */
+void flight_land(flight *f, int complete) {
+    flight **link = &buckets[f->hash & (FLIGHT_BUCKETS - 1)];
+
+    pthread_mutex_lock(&flight_lock);
+    // Misses from now on find the cache, or start a fetch of their own
+    while (*link != f)
+        link = &(*link)->next;
+    *link = f->next;
+
+    f->landed = 1;
+    f->complete = complete;
+    wake(f);
+    pthread_mutex_unlock(&flight_lock);
+}
+
+/* Follower: block until more than off bytes are published or f lands; returns the bytes published */
+size_t flight_wait(flight *f, size_t off) {
+    size_t size;
+
+    pthread_mutex_lock(&flight_lock);
+    while (!f->landed && f->size <= off)
+        pthread_cond_wait(&f->cond, &flight_lock);
+    size = f->size;
+    pthread_mutex_unlock(&flight_lock);
+    return size;
+}
+
+/*
+ * Follower without blocking: return the bytes published and set
+ * *landed. If there is nothing past off and f is still filling, e is
+ * posted once that changes.
+ */
+size_t flight_poll(flight *f, size_t off, notice *e, int *landed) {
+    size_t size;
+
+    pthread_mutex_lock(&flight_lock);
+    size = f->size;
+    if (!(*landed = f->landed) && size <= off) {
+        e->next = f->waiters;
+        f->waiters = e;
+    }
+    pthread_mutex_unlock(&flight_lock);
+    return size;
+}
+
+/* Drop a reference taken by flight_join */
+void flight_release(flight *f) {
+    pthread_mutex_lock(&flight_lock);
+    put(f);
+    pthread_mutex_unlock(&flight_lock);
+}
+
+/* Wake every follower waiting on f; each waits again once it has caught up. Caller holds flight_lock */
+static void wake(flight *f) {
+    notice *e;
+
+    pthread_cond_broadcast(&f->cond);
+    while ((e = f->waiters) != NULL) {
+        f->waiters = e->next;
+        notice_post(e);
+    }
+}
+
+/* Drop a reference, freeing f with the last; caller holds flight_lock */
+static void put(flight *f) {
+    if (--f->refcnt > 0)
+        return;
+    pthread_cond_destroy(&f->cond);
+    Free(f->data);
+    Free(f->uri);
+    Free(f);
+}
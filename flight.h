@@ -0,0 +1,32 @@
+#ifndef __FLIGHT_H__
+#define __FLIGHT_H__
+
+#include "csapp.h"
+#include "notify.h"
+
+#define FLIGHT_BUCKETS 256  // Hash buckets of URIs being fetched (power of two)
+
+// Origin fetch of a URI, filling in as it downloads. Concurrent misses on
+// the same URI follow it, relaying the response from data as it lands.
+typedef struct flight {
+    char *uri;                    // Key; a copy owned by the flight
+    unsigned int hash;
+    int refcnt;                   // The leader plus each follower
+    char *data;                   // The leader's copy of the response (MAX_OBJECT_SIZE bytes)
+    size_t size;                  // Bytes of data published to followers; they never change afterwards
+    int landed;                   // The leader is done with the flight; size is final
+    int complete;                 // It landed with the whole response in data
+    pthread_cond_t cond;          // Threads waiting for size to grow or the flight to land
+    notice *waiters;              // Event loop connections waiting for the same
+    struct flight *next;          // Next flight in the same bucket
+} flight;
+
+/* Function Prototypes */
+flight *flight_join(char *uri, int *leader);
+void flight_publish(flight *f, size_t size);
+void flight_land(flight *f, int complete);
+size_t flight_wait(flight *f, size_t off);
+size_t flight_poll(flight *f, size_t off, notice *e, int *landed);
+void flight_release(flight *f);
+
+#endif /* __FLIGHT_H__ */
@@ -0,0 +1,757 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "http.h"
+
+static char *scan_ctl(char *p, char *end, int stop_at_space);
+static int take_eol(char **pp, char *end);
+static int parse_target(http_request *req);
+static http_header_id lookup_header(http_str name);
+static int take_line(http_response *resp, const char *buf, size_t n, size_t *used);
+static void parse_line(http_response *resp);
+static void end_of_headers(http_response *resp);
+static int has_token(const char *value, size_t len, const char *token);
+static void reset_caching(http_response *resp);
+static void parse_cache_control(http_response *resp, char *value);
+static time_t parse_date(const char *value);
+static int heuristic_status(int status);
+static const char *header_lines(const char *p, const char *end, const char **lines);
+static int has_field(const char *p, const char *end, const char *name, size_t len);
+static int merged_field(const char *name, size_t len);
+static int append(char *out, size_t size, size_t *n, const char *p, size_t len);
+static time_t freshness(http_response *resp, int status, time_t now);
+
+// RFC 9110 token characters: methods and header names
+static const unsigned char tchar[256] = {
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1, ['+'] = 1,
+    ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1,
+    ['0' ... '9'] = 1, ['A' ... 'Z'] = 1, ['a' ... 'z'] = 1,
+};
+
+// Header names the proxy looks up or strips, checked by length first
+static const struct {
+    const char *name;
+    size_t len;
+    http_header_id id;
+} known_headers[] = {
+    {"Host", 4, HDR_HOST},
+    {"User-Agent", 10, HDR_USER_AGENT},
+    {"If-None-Match", 13, HDR_IF_NONE_MATCH},
+    {"If-Modified-Since", 17, HDR_IF_MODIFIED_SINCE},
+    {"If-Match", 8, HDR_IF_MATCH},
+    {"If-Unmodified-Since", 19, HDR_IF_UNMODIFIED_SINCE},
+    {"If-Range", 8, HDR_IF_RANGE},
+    {"Range", 5, HDR_RANGE},
+    {"Authorization", 13, HDR_AUTHORIZATION},
+    {"Cookie", 6, HDR_COOKIE},
+    {"Connection", 10, HDR_CONNECTION},
+    {"Proxy-Connection", 16, HDR_PROXY_CONNECTION},
+    {"Keep-Alive", 10, HDR_KEEP_ALIVE},
+    {"Proxy-Authorization", 19, HDR_PROXY_AUTHORIZATION},
+    {"TE", 2, HDR_TE},
+    {"Trailer", 7, HDR_TRAILER},
+    {"Transfer-Encoding", 17, HDR_TRANSFER_ENCODING},
+    {"Upgrade", 7, HDR_UPGRADE},
+};
+
+// Fields a 304 does not update in the stored response: they frame its body or describe the connection
+static const char *const unmerged_headers[] = {
+    "Content-Length", "Content-Range", "Content-Encoding", "Transfer-Encoding", "Connection",
+    "Proxy-Connection", "Keep-Alive", "TE", "Trailer", "Upgrade",
+};
+
+static char root_path[] = "/";  // Path of a URI that has none
+
+int http_default_lifetime = HTTP_DEFAULT_LIFETIME;  // 0 leaves such responses uncached
+
+/*
+ * Parse the request head at the start of buf in a single pass, without
+ * copying: req's fields all point into buf. Returns the length of the
+ * head (through the blank line), HTTP_PARSE_INCOMPLETE if buf ends
+ * first, or HTTP_PARSE_ERROR. On success the URI is also NUL-terminated
+ * in place, over the space that followed it, so it can be printed as is.
+ */
+int http_parse_request(http_request *req, char *buf, size_t len) {
+    char *p = buf, *end = buf + len, *tok, *value_end;
+    int rc;
+
+    req->header_count = 0;
+    for (int i = 0; i < HDR_COUNT; i++)
+        req->known[i] = -1;
+
+    // Empty lines before the request line are ignored
+    while (p < end && (*p == '\r' || *p == '\n'))
+        p++;
+
+    // method SP request-target SP HTTP-version CRLF
+    for (tok = p; p < end && tchar[(unsigned char)*p]; p++)
+        ;
+    if (p == end)
+        return HTTP_PARSE_INCOMPLETE;
+    if (p == tok || *p != ' ')
+        return HTTP_PARSE_ERROR;
+    req->method = (http_str){tok, p - tok};
+
+    tok = ++p;
+    if ((p = scan_ctl(p, end, 1)) == end)
+        return HTTP_PARSE_INCOMPLETE;
+    if (p == tok || *p != ' ')
+        return HTTP_PARSE_ERROR;
+    req->uri = (http_str){tok, p - tok};
+
+    if (end - ++p < 8)
+        return HTTP_PARSE_INCOMPLETE;
+    if (memcmp(p, "HTTP/1.", 7) || !isdigit((unsigned char)p[7]))
+        return HTTP_PARSE_ERROR;
+    req->version = (http_str){p, 8};
+    req->minor_version = p[7] - '0';
+    p += 8;
+    if ((rc = take_eol(&p, end)) <= 0)
+        return rc < 0 ? HTTP_PARSE_ERROR : HTTP_PARSE_INCOMPLETE;
+
+    // field-name ":" OWS field-value OWS CRLF, until the empty line
+    while ((rc = take_eol(&p, end)) < 0) {
+        http_header *h = &req->headers[req->header_count];
+
+        if (req->header_count == HTTP_MAX_HEADERS)
+            return HTTP_PARSE_ERROR;
+        for (tok = p; p < end && tchar[(unsigned char)*p]; p++)
+            ;
+        if (p == end)
+            return HTTP_PARSE_INCOMPLETE;
+        if (p == tok || *p != ':')
+            return HTTP_PARSE_ERROR;
+        h->name = (http_str){tok, p - tok};
+
+        for (p++; p < end && (*p == ' ' || *p == '\t'); p++)
+            ;
+        tok = p;
+        while ((p = scan_ctl(p, end, 0)) < end && *p == '\t')
+            p++;  // Tabs are allowed inside values
+        if (p == end)
+            return HTTP_PARSE_INCOMPLETE;
+        for (value_end = p; value_end > tok && (value_end[-1] == ' ' || value_end[-1] == '\t'); value_end--)
+            ;
+        h->value = (http_str){tok, value_end - tok};
+        if ((rc = take_eol(&p, end)) <= 0)
+            return rc < 0 ? HTTP_PARSE_ERROR : HTTP_PARSE_INCOMPLETE;
+
+        h->id = lookup_header(h->name);
+        if (req->known[h->id] < 0)
+            req->known[h->id] = req->header_count;
+        req->header_count++;
+    }
+    if (rc == 0)
+        return HTTP_PARSE_INCOMPLETE;
+
+    if (parse_target(req) < 0)
+        return HTTP_PARSE_ERROR;
+    req->uri.p[req->uri.len] = '\0';
+    return p - buf;
+}
+
+/* Case-insensitive comparison of a parsed field with a string */
+int http_str_eq(http_str s, const char *lit) {
+    return strlen(lit) == s.len && !strncasecmp(s.p, lit, s.len);
+}
+
+/* Does the client want the connection kept open after this request? */
+int http_request_keep_alive(http_request *req) {
+    int keep_alive = req->minor_version >= 1;  // HTTP/1.1 is persistent by default
+
+    for (int i = 0; i < req->header_count; i++) {
+        http_header *h = &req->headers[i];
+        if (h->id != HDR_CONNECTION && h->id != HDR_PROXY_CONNECTION)
+            continue;
+        if (has_token(h->value.p, h->value.len, "close"))
+            keep_alive = 0;
+        else if (has_token(h->value.p, h->value.len, "keep-alive"))
+            keep_alive = 1;
+    }
+    return keep_alive;
+}
+
+/* Is h hop-by-hop, either by name or because a Connection header lists it? */
+int http_request_hop(http_request *req, http_header *h) {
+    if (http_header_hop(h->id))
+        return 1;
+    for (int i = req->known[HDR_CONNECTION]; i >= 0 && i < req->header_count; i++) {
+        http_str value = req->headers[i].value;
+        if (req->headers[i].id != HDR_CONNECTION)
+            continue;
+
+        // Walk the comma-separated option names
+        for (char *p = value.p, *end = value.p + value.len, *tok; p < end; p++) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+                p++;
+            for (tok = p; p < end && *p != ',' && *p != ' ' && *p != '\t'; p++)
+                ;
+            if ((size_t)(p - tok) == h->name.len && !strncasecmp(tok, h->name.p, h->name.len))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Copy the origin's host and port (80 by default) out as strings; -1 if they do not fit */
+int http_request_origin(http_request *req, char *hostname, size_t hostlen, char *port, size_t portlen) {
+    if (req->host.len >= hostlen || req->port.len >= portlen)
+        return -1;
+    memcpy(hostname, req->host.p, req->host.len);
+    hostname[req->host.len] = '\0';
+    if (req->port.len) {
+        memcpy(port, req->port.p, req->port.len);
+        port[req->port.len] = '\0';
+    } else {
+        snprintf(port, portlen, "80");
+    }
+    return 0;
+}
+
+/*
+ * Write the key that caches and coalesces req into key, of size bytes:
+ * "http://host:port/path" with the host lowercased and the port always
+ * given, so an origin-form request and an absolute-form one for the same
+ * resource meet, and requests for different hosts never do. Returns -1 if
+ * it does not fit.
+ */
+int http_request_key(http_request *req, char *key, size_t size) {
+    int bracket = memchr(req->host.p, ':', req->host.len) != NULL;  // IPv6 literal
+    int n = snprintf(key, size, "http://%s%.*s%s:%.*s%s%.*s", bracket ? "[" : "",
+                     (int)req->host.len, req->host.p, bracket ? "]" : "",
+                     req->port.len ? (int)req->port.len : 2, req->port.len ? req->port.p : "80",
+                     http_path_slash(req) ? "/" : "", (int)req->path.len, req->path.p);
+
+    if (n < 0 || (size_t)n >= size)
+        return -1;
+    for (size_t i = 0; i < req->host.len; i++)
+        key[7 + bracket + i] = tolower((unsigned char)key[7 + bracket + i]);
+    return 0;
+}
+
+/* Does req's path need a '/' in front? Only "http://host?query" leaves it out */
+int http_path_slash(http_request *req) {
+    return req->path.p[0] == '?';
+}
+
+/* Did the client make the request conditional, or ask for part of the object? */
+int http_request_conditional(http_request *req) {
+    return req->known[HDR_IF_NONE_MATCH] >= 0 || req->known[HDR_IF_MODIFIED_SINCE] >= 0 ||
+           req->known[HDR_IF_MATCH] >= 0 || req->known[HDR_IF_UNMODIFIED_SINCE] >= 0 ||
+           req->known[HDR_IF_RANGE] >= 0 || req->known[HDR_RANGE] >= 0;
+}
+
+/* Does the request identify a user? Its response is then not for other clients (RFC 9111, section 3.5) */
+int http_request_credentials(http_request *req) {
+    return req->known[HDR_AUTHORIZATION] >= 0 || req->known[HDR_COOKIE] >= 0;
+}
+
+/*
+ * Return the first byte in [p, end) that is a control character (or a
+ * space too, if stop_at_space), or end. Checks 16 bytes per step with
+ * SSE2, which every x86-64 has, and finishes byte by byte.
+ */
+static char *scan_ctl(char *p, char *end, int stop_at_space) {
+    unsigned char limit = stop_at_space ? 0x20 : 0x1f;
+
+#ifdef __SSE2__
+    const __m128i max = _mm_set1_epi8(limit), del = _mm_set1_epi8(0x7f);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        // v <= limit (unsigned) exactly when min(v, limit) == v
+        __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, max), v), _mm_cmpeq_epi8(v, del));
+        int mask = _mm_movemask_epi8(stop);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    for (; p < end; p++)
+        if ((unsigned char)*p <= limit || *p == 0x7f)
+            return p;
+    return end;
+}
+
+/* Step over a CRLF (or bare LF) at *pp: 1 if done, 0 if buf ends first, -1 if there is none */
+static int take_eol(char **pp, char *end) {
+    char *p = *pp;
+
+    if (p == end)
+        return 0;
+    if (*p == '\r') {
+        if (++p == end)
+            return 0;
+        if (*p != '\n')
+            return -1;
+    } else if (*p != '\n') {
+        return -1;
+    }
+    *pp = p + 1;
+    return 1;
+}
+
+/* Split the request target into host, port and path; absolute URIs and origin-form with Host */
+static int parse_target(http_request *req) {
+    char *p = req->uri.p, *end = p + req->uri.len, *host, *path, *colon;
+
+    if (req->uri.len > 7 && !strncasecmp(p, "http://", 7)) {
+        host = p + 7;
+        for (path = host; path < end && *path != '/' && *path != '?'; path++)
+            ;
+        req->path = path < end ? (http_str){path, end - path} : (http_str){root_path, 1};
+    } else if (*p == '/' && req->known[HDR_HOST] >= 0) {
+        host = req->headers[req->known[HDR_HOST]].value.p;
+        path = host + req->headers[req->known[HDR_HOST]].value.len;
+        req->path = req->uri;
+    } else {
+        return -1;
+    }
+
+    // host [":" port], with IPv6 literals in brackets
+    req->port = (http_str){NULL, 0};
+    if (*host == '[') {
+        if (!(colon = memchr(host, ']', path - host)))
+            return -1;
+        req->host = (http_str){host + 1, colon - host - 1};
+        colon++;
+    } else {
+        if (!(colon = memchr(host, ':', path - host)))
+            colon = path;
+        req->host = (http_str){host, colon - host};
+    }
+    if (colon < path && *colon == ':')
+        req->port = (http_str){colon + 1, path - colon - 1};
+    return req->host.len ? 0 : -1;
+}
+
+/* Find name in the table of known headers */
+static http_header_id lookup_header(http_str name) {
+    for (size_t i = 0; i < sizeof(known_headers) / sizeof(known_headers[0]); i++)
+        if (known_headers[i].len == name.len && !strncasecmp(known_headers[i].name, name.p, name.len))
+            return known_headers[i].id;
+    return HDR_OTHER;
+}
+
+/*
+ * Prepare resp for a new response; a HEAD response never has a body,
+ * and one to a request with credentials is only cached if it says so
+ */
+void http_response_init(http_response *resp, int head_request, int credentials) {
+    resp->state = RESP_STATUS;
+    resp->line_len = 0;
+    resp->status = 0;
+    resp->keep_alive = 0;
+    resp->chunked = 0;
+    resp->no_body = head_request;
+    resp->credentials = credentials;
+    resp->content_length = -1;
+    resp->remaining = 0;
+    reset_caching(resp);
+}
+
+/*
+ * Advance the parser over n bytes of response. Returns how many of them
+ * belong to this response: all n, unless the response ended part-way
+ * through buf (state is then RESP_DONE).
+ */
+size_t http_response_feed(http_response *resp, const char *buf, size_t n) {
+    size_t used = 0;
+
+    while (used < n && resp->state != RESP_DONE) {
+        switch (resp->state) {
+        case RESP_BODY:
+        case RESP_CHUNK_DATA: {
+            size_t take = n - used;
+            if ((long long)take > resp->remaining)
+                take = resp->remaining;
+            used += take;
+            resp->remaining -= take;
+            if (resp->remaining == 0)
+                resp->state = resp->state == RESP_BODY ? RESP_DONE : RESP_CHUNK_END;
+            break;
+        }
+        case RESP_UNTIL_EOF:
+            used = n;
+            break;
+        default:
+            // Every other state consumes whole lines
+            if (take_line(resp, buf + used, n - used, &used))
+                parse_line(resp);
+            break;
+        }
+    }
+    return used;
+}
+
+/* Has the response ended? eof says whether the origin has closed the connection */
+int http_response_complete(http_response *resp, int eof) {
+    return resp->state == RESP_DONE || (eof && resp->state == RESP_UNTIL_EOF);
+}
+
+/*
+ * Account for n body bytes the caller relayed without feeding them, as
+ * when they are spliced straight between sockets. Only valid in
+ * RESP_BODY (n at most remaining) and RESP_UNTIL_EOF.
+ */
+void http_response_skip(http_response *resp, size_t n) {
+    if (resp->state == RESP_BODY && (resp->remaining -= n) == 0)
+        resp->state = RESP_DONE;
+}
+
+/*
+ * Write the head of the stored response with the header fields of a 304
+ * that just confirmed it merged in (RFC 9111, section 4.3.4) to out, of
+ * size bytes: each field the 304 carries replaces the stored ones of that
+ * name, apart from those that frame the body, which stays as stored and
+ * is not written. head holds the 304's head. Returns the size written,
+ * blank line included, and sets *body to where the body starts in stored;
+ * returns 0 if it does not fit or either head is incomplete.
+ */
+size_t http_response_merge(const char *stored, size_t stored_size, const char *head, size_t head_len,
+                           char *out, size_t size, size_t *body) {
+    const char *stored_end = stored + stored_size, *stored_lines, *stored_blank;
+    const char *head_lines, *head_blank, *p, *eol, *colon;
+    size_t n = 0;
+
+    if (!(stored_blank = header_lines(stored, stored_end, &stored_lines)) ||
+        !(head_blank = header_lines(head, head + head_len, &head_lines)))
+        return 0;
+
+    // The stored status line, then each stored field the 304 does not replace
+    if (!append(out, size, &n, stored, stored_lines - stored))
+        return 0;
+    for (p = stored_lines; p < stored_blank; p = eol + 1) {
+        eol = memchr(p, '\n', stored_blank - p);
+        colon = memchr(p, ':', eol - p);
+        if (colon && merged_field(p, colon - p) && has_field(head_lines, head_blank, p, colon - p))
+            continue;
+        if (!append(out, size, &n, p, eol + 1 - p))
+            return 0;
+    }
+
+    // The 304's own fields, then the stored blank line
+    for (p = head_lines; p < head_blank; p = eol + 1) {
+        eol = memchr(p, '\n', head_blank - p);
+        colon = memchr(p, ':', eol - p);
+        if (colon && merged_field(p, colon - p) && !append(out, size, &n, p, eol + 1 - p))
+            return 0;
+    }
+    eol = memchr(stored_blank, '\n', stored_end - stored_blank);
+    if (!append(out, size, &n, stored_blank, eol + 1 - stored_blank))
+        return 0;
+    *body = eol + 1 - stored;
+    return n;
+}
+
+/*
+ * Find the ETag and Last-Modified headers of the stored response, whose
+ * header block is at the start of response; returns 1 if it has either,
+ * so that the origin can be asked whether it is still current.
+ */
+int http_response_validators(char *response, size_t size, http_validators *v) {
+    char *p, *end = response + size, *eol, *value;
+
+    v->etag.len = v->last_modified.len = 0;
+
+    // Skip the status line, then take one header line at a time until the blank one
+    for (p = memchr(response, '\n', size); p && ++p < end && (eol = memchr(p, '\n', end - p)) && eol - p > 1;
+         p = eol) {
+        http_str *field = !strncasecmp(p, "ETag:", strlen("ETag:")) ? &v->etag :
+                          !strncasecmp(p, "Last-Modified:", strlen("Last-Modified:")) ? &v->last_modified : NULL;
+        if (!field)
+            continue;
+        for (value = memchr(p, ':', eol - p) + 1; *value == ' ' || *value == '\t'; value++)
+            ;
+        field->p = value;
+        for (field->len = eol - value; field->len > 0 && isspace((unsigned char)value[field->len - 1]); field->len--)
+            ;
+    }
+    return v->etag.len > 0 || v->last_modified.len > 0;
+}
+
+/*
+ * Find the header fields of the response head at p: set *lines to the
+ * line after the status line and return the start of the blank line that
+ * ends the fields, or NULL if it is not in [p, end).
+ */
+static const char *header_lines(const char *p, const char *end, const char **lines) {
+    const char *eol;
+
+    if (!(eol = memchr(p, '\n', end - p)))
+        return NULL;
+    for (*lines = p = eol + 1; p < end && (eol = memchr(p, '\n', end - p)); p = eol + 1)
+        if (eol == p || (eol - p == 1 && *p == '\r'))
+            return p;
+    return NULL;
+}
+
+/* Is there a field called name (len bytes) among the header lines in [p, end)? */
+static int has_field(const char *p, const char *end, const char *name, size_t len) {
+    for (const char *eol; p < end; p = eol + 1) {
+        eol = memchr(p, '\n', end - p);
+        if ((size_t)(eol - p) > len && p[len] == ':' && !strncasecmp(p, name, len))
+            return 1;
+    }
+    return 0;
+}
+
+/* May a 304's field called name (len bytes) replace the stored ones? */
+static int merged_field(const char *name, size_t len) {
+    for (size_t i = 0; i < sizeof(unmerged_headers) / sizeof(unmerged_headers[0]); i++)
+        if (strlen(unmerged_headers[i]) == len && !strncasecmp(unmerged_headers[i], name, len))
+            return 0;
+    return 1;
+}
+
+/* Copy len bytes from p to out at *n, if they fit in its size bytes */
+static int append(char *out, size_t size, size_t *n, const char *p, size_t len) {
+    if (len > size - *n)
+        return 0;
+    memcpy(out + *n, p, len);
+    *n += len;
+    return 1;
+}
+
+/* Append bytes to the pending line; returns 1 once a full line (without CRLF) is in resp->line */
+static int take_line(http_response *resp, const char *buf, size_t n, size_t *used) {
+    const char *nl = memchr(buf, '\n', n);
+    size_t len = nl ? (size_t)(nl - buf) + 1 : n;
+
+    *used += len;
+    if (resp->line_len + len >= sizeof(resp->line)) {
+        // A line this long is not HTTP we can delimit; relay the rest as-is
+        resp->state = RESP_UNTIL_EOF;
+        resp->keep_alive = 0;
+        return 0;
+    }
+    memcpy(resp->line + resp->line_len, buf, len);
+    resp->line_len += len;
+    if (!nl)
+        return 0;
+
+    // Strip the line terminator
+    while (resp->line_len > 0 &&
+           (resp->line[resp->line_len - 1] == '\n' || resp->line[resp->line_len - 1] == '\r'))
+        resp->line_len--;
+    resp->line[resp->line_len] = '\0';
+    resp->line_len = 0;
+    return 1;
+}
+
+/* Act on one complete line in resp->line */
+static void parse_line(http_response *resp) {
+    char *line = resp->line, *value;
+    int minor;
+
+    switch (resp->state) {
+    case RESP_STATUS:
+        if (sscanf(line, "HTTP/1.%d %d", &minor, &resp->status) != 2) {
+            resp->state = RESP_UNTIL_EOF;  // Not HTTP/1.x; relay until close
+            resp->keep_alive = 0;
+            return;
+        }
+        resp->keep_alive = minor >= 1;  // HTTP/1.1 is persistent by default
+        resp->state = RESP_HEADERS;
+        reset_caching(resp);  // Forget any interim response's headers
+        break;
+
+    case RESP_HEADERS:
+        if (*line == '\0') {
+            end_of_headers(resp);
+            return;
+        }
+        if (!(value = strchr(line, ':')))
+            return;
+        for (value++; *value == ' ' || *value == '\t'; value++)
+            ;
+        if (!strncasecmp(line, "Content-Length:", strlen("Content-Length:")))
+            resp->content_length = strtoll(value, NULL, 10);
+        else if (!strncasecmp(line, "Transfer-Encoding:", strlen("Transfer-Encoding:")))
+            resp->chunked = has_token(value, strlen(value), "chunked");
+        else if (!strncasecmp(line, "Connection:", strlen("Connection:"))) {
+            if (has_token(value, strlen(value), "close"))
+                resp->keep_alive = 0;
+            else if (has_token(value, strlen(value), "keep-alive"))
+                resp->keep_alive = 1;
+        }
+        else if (!strncasecmp(line, "Cache-Control:", strlen("Cache-Control:")))
+            parse_cache_control(resp, value);
+        else if (!strncasecmp(line, "Expires:", strlen("Expires:"))) {
+            if ((resp->expires = parse_date(value)) < 0)
+                resp->expires = 0;  // An invalid date means already expired
+        }
+        else if (!strncasecmp(line, "Date:", strlen("Date:")))
+            resp->date = parse_date(value);
+        else if (!strncasecmp(line, "Last-Modified:", strlen("Last-Modified:")))
+            resp->last_modified = parse_date(value);
+        else if (!strncasecmp(line, "Age:", strlen("Age:")))
+            resp->age = strtoll(value, NULL, 10);
+        else if (!strncasecmp(line, "Set-Cookie:", strlen("Set-Cookie:")) ||
+                 !strncasecmp(line, "Vary:", strlen("Vary:")))
+            resp->no_store = 1;  // Meant for one client, or for requests that differ in more than the URI
+        break;
+
+    case RESP_CHUNK_SIZE:
+        resp->remaining = strtoll(line, NULL, 16);  // Chunk extensions after ';' are ignored
+        resp->state = resp->remaining > 0 ? RESP_CHUNK_DATA : RESP_TRAILER;
+        break;
+
+    case RESP_CHUNK_END:
+        resp->state = RESP_CHUNK_SIZE;
+        break;
+
+    case RESP_TRAILER:
+        if (*line == '\0')
+            resp->state = RESP_DONE;
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Decide how the body is delimited, and how long it may be cached, once the blank line after the headers arrives */
+static void end_of_headers(http_response *resp) {
+    if (resp->status / 100 == 1) {
+        resp->state = RESP_STATUS;  // Interim response; the real one follows
+        return;
+    }
+    resp->fresh_until = freshness(resp, resp->status, time(NULL));
+
+    if (resp->no_body || resp->status == 204 || resp->status == 304) {
+        resp->state = RESP_DONE;
+    } else if (resp->chunked) {
+        resp->state = RESP_CHUNK_SIZE;
+    } else if (resp->content_length >= 0) {
+        resp->remaining = resp->content_length;
+        resp->state = resp->remaining > 0 ? RESP_BODY : RESP_DONE;
+    } else {
+        resp->state = RESP_UNTIL_EOF;
+        resp->keep_alive = 0;
+    }
+}
+
+/* Case-insensitive search for token in a header value of len bytes */
+static int has_token(const char *value, size_t len, const char *token) {
+    size_t n = strlen(token);
+
+    for (; len >= n; value++, len--)
+        if (!strncasecmp(value, token, n))
+            return 1;
+    return 0;
+}
+
+/* Clear what the caching headers said, before any have been parsed */
+static void reset_caching(http_response *resp) {
+    resp->no_store = resp->no_cache = resp->shared = 0;
+    resp->max_age = resp->s_maxage = resp->age = -1;
+    resp->date = resp->expires = resp->last_modified = -1;
+    resp->fresh_until = 0;
+}
+
+/* Pick out the Cache-Control directives a shared cache acts on */
+static void parse_cache_control(http_response *resp, char *value) {
+    char *directive, *save;
+
+    for (directive = strtok_r(value, ",", &save); directive; directive = strtok_r(NULL, ",", &save)) {
+        while (*directive == ' ' || *directive == '\t')
+            directive++;
+        if (!strncasecmp(directive, "no-store", strlen("no-store")) ||
+            !strncasecmp(directive, "private", strlen("private")))
+            resp->no_store = 1;
+        else if (!strncasecmp(directive, "no-cache", strlen("no-cache")))
+            resp->no_cache = 1;
+        else if (!strncasecmp(directive, "public", strlen("public")) ||
+                 !strncasecmp(directive, "must-revalidate", strlen("must-revalidate")))
+            resp->shared = 1;
+        else if (!strncasecmp(directive, "max-age=", strlen("max-age=")))
+            resp->max_age = strtoll(directive + strlen("max-age="), NULL, 10);
+        else if (!strncasecmp(directive, "s-maxage=", strlen("s-maxage=")))
+            resp->s_maxage = strtoll(directive + strlen("s-maxage="), NULL, 10);
+    }
+}
+
+/* Parse an HTTP-date in any of the three formats HTTP/1.1 allows; -1 if it is none of them */
+static time_t parse_date(const char *value) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    const char *m;
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(value, "%*3s, %d %3s %d %d:%d:%d GMT",  // Sun, 06 Nov 1994 08:49:37 GMT
+               &tm.tm_mday, month, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6 &&
+        sscanf(value, "%*[^,], %d-%3s-%d %d:%d:%d GMT",  // Sunday, 06-Nov-94 08:49:37 GMT
+               &tm.tm_mday, month, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6 &&
+        sscanf(value, "%*3s %3s %d %d:%d:%d %d",  // Sun Nov  6 08:49:37 1994
+               month, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &tm.tm_year) != 6)
+        return -1;
+
+    month[3] = '\0';
+    if (strlen(month) != 3 || !(m = strstr(months, month)) || (m - months) % 3)
+        return -1;
+    tm.tm_mon = (m - months) / 3;
+    if (tm.tm_year < 100)
+        tm.tm_year += tm.tm_year < 70 ? 2000 : 1900;  // Two-digit years
+    tm.tm_year -= 1900;
+    return timegm(&tm);
+}
+
+/* Statuses a cache may keep without being told how long (RFC 9110, section 15.1) */
+static int heuristic_status(int status) {
+    switch (status) {
+    case 200: case 203: case 204: case 300: case 301: case 308:
+    case 404: case 405: case 410: case 414: case 501:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * When a response with resp's headers and the given status, received at
+ * now, goes stale in a shared cache, or 0 if it must not be stored. The
+ * lifetime comes from s-maxage, max-age or Expires; failing those,
+ * statuses that are cacheable by default get a share of the time since
+ * Last-Modified, and a 200 gets at least http_default_lifetime, as it
+ * would without Last-Modified. Time the response already spent in caches
+ * upstream is taken off.
+ */
+static time_t freshness(http_response *resp, int status, time_t now) {
+    time_t date = resp->date >= 0 ? resp->date : now;
+    long long lifetime, age;
+
+    // Partial and not-modified responses are not whole objects, and a
+    // no-cache response is only reusable after asking the origin again
+    if (resp->no_store || resp->no_cache || status == 206 || status == 304)
+        return 0;
+
+    // An answer to one user's credentials is theirs alone unless the origin says it may be shared
+    if (resp->credentials && !resp->shared && resp->s_maxage < 0)
+        return 0;
+
+    if (resp->s_maxage >= 0)
+        lifetime = resp->s_maxage;
+    else if (resp->max_age >= 0)
+        lifetime = resp->max_age;
+    else if (resp->expires >= 0)
+        lifetime = resp->expires - date;
+    else if (heuristic_status(status) && (resp->last_modified >= 0 || status == 200)) {
+        lifetime = 0;
+        if (resp->last_modified >= 0 && date > resp->last_modified)
+            lifetime = (long long)(date - resp->last_modified) * HTTP_HEURISTIC_PERCENT / 100;
+        if (lifetime > HTTP_HEURISTIC_MAX)
+            lifetime = HTTP_HEURISTIC_MAX;
+
+        // A recent Last-Modified must not make a 200 less cacheable than none at all
+        if (status == 200 && lifetime < http_default_lifetime)
+            lifetime = http_default_lifetime;
+    } else {
+        return 0;
+    }
+
+    // The response's age when it arrived: as old as its Date says, or as Age says if older
+    age = now > date ? now - date : 0;
+    if (resp->age > age)
+        age = resp->age;
+    return lifetime > age ? now + (lifetime - age) : 0;
+}
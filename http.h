@@ -0,0 +1,129 @@
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include "csapp.h"
+
+#define HTTP_MAX_HEADERS 64        // Header fields kept per request
+#define HTTP_MAX_IOV (2 * HTTP_MAX_HEADERS + 14)  // Vectors in a rewritten request
+#define HTTP_PARSE_ERROR -1        // http_parse_request: not a request we can serve
+#define HTTP_PARSE_INCOMPLETE -2   // http_parse_request: the head has not all arrived
+#define HTTP_HEURISTIC_PERCENT 10  // Without explicit freshness, a response stays fresh for this share of its age at Last-Modified
+#define HTTP_HEURISTIC_MAX 86400   // ... but at most this many seconds
+#define HTTP_DEFAULT_LIFETIME 300  // Seconds a 200 with no explicit freshness stays fresh at least, overridden by proxy -f
+
+// Slice of the buffer a request was parsed from; not NUL-terminated
+typedef struct {
+    char *p;
+    size_t len;
+} http_str;
+
+// Header fields the proxy acts on; the hop-by-hop ones start at HDR_CONNECTION
+typedef enum {
+    HDR_OTHER,
+    HDR_HOST,
+    HDR_USER_AGENT,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_IF_MATCH,
+    HDR_IF_UNMODIFIED_SINCE,
+    HDR_IF_RANGE,
+    HDR_RANGE,
+    HDR_AUTHORIZATION,
+    HDR_COOKIE,
+    HDR_CONNECTION,
+    HDR_PROXY_CONNECTION,
+    HDR_KEEP_ALIVE,
+    HDR_PROXY_AUTHORIZATION,
+    HDR_TE,
+    HDR_TRAILER,
+    HDR_TRANSFER_ENCODING,
+    HDR_UPGRADE,
+    HDR_COUNT
+} http_header_id;
+
+#define http_header_hop(id) ((id) >= HDR_CONNECTION)
+
+typedef struct {
+    http_str name, value;         // Value without surrounding whitespace
+    http_header_id id;
+} http_header;
+
+// Request head parsed in place; every field points into the caller's buffer
+typedef struct {
+    http_str method, uri, version;
+    int minor_version;            // x in HTTP/1.x
+    http_str host, port, path;    // Origin and path from the URI (or Host); port is empty if absent
+                                  // path starts at the '?' of a URI with a query but no path; see http_path_slash
+    http_header headers[HTTP_MAX_HEADERS];
+    int header_count;
+    int known[HDR_COUNT];         // Index of the first header of each kind, or -1
+} http_request;
+
+// Validators of a stored response, pointing into its header block; len is 0 if absent
+typedef struct {
+    http_str etag;
+    http_str last_modified;
+} http_validators;
+
+// Where a response parser is within the message
+typedef enum {
+    RESP_STATUS,      // Waiting for the status line
+    RESP_HEADERS,     // Reading header lines
+    RESP_BODY,        // Reading a Content-Length delimited body
+    RESP_CHUNK_SIZE,  // Reading a chunk-size line
+    RESP_CHUNK_DATA,  // Reading chunk data
+    RESP_CHUNK_END,   // Reading the CRLF after chunk data
+    RESP_TRAILER,     // Reading trailer lines after the last chunk
+    RESP_UNTIL_EOF,   // No length given: the body runs until the origin closes
+    RESP_DONE         // The whole response has been seen
+} resp_state;
+
+// Incremental HTTP/1.x response parser. It is fed the bytes read from the
+// origin and only delimits the message; the bytes themselves are relayed
+// unchanged by the caller.
+typedef struct {
+    resp_state state;
+    char line[MAXLINE];       // Partial status, header or chunk-size line
+    size_t line_len;
+    int status;               // Status code
+    int keep_alive;           // Origin leaves the connection open afterwards
+    int chunked;              // Transfer-Encoding: chunked
+    int no_body;              // Response to HEAD: headers only
+    long long content_length; // Content-Length, or -1 if absent
+    long long remaining;      // Bytes left in the body or current chunk
+
+    // Caching headers; the times are -1 if absent
+    int no_store;             // no-store, private, Set-Cookie or Vary: a shared cache keyed by URI must not keep it
+    int no_cache;             // Cache-Control: no-cache: not to be reused without asking the origin
+    int shared;               // Cache-Control: public or must-revalidate: may be stored even if the request had credentials
+    int credentials;          // The request carried Authorization or Cookie, so the response is one user's unless it says otherwise
+    long long max_age;        // Cache-Control: max-age, or -1
+    long long s_maxage;       // Cache-Control: s-maxage, or -1; overrides max-age for shared caches
+    long long age;            // Age: seconds spent in caches upstream, or -1
+    time_t date;              // Date
+    time_t expires;           // Expires; 0 if it is not a valid date, which means already expired
+    time_t last_modified;     // Last-Modified
+    time_t fresh_until;       // Set once the headers are in: when the response goes stale, or 0 if it must not be cached
+} http_response;
+
+extern int http_default_lifetime;
+
+/* Function Prototypes */
+int http_parse_request(http_request *req, char *buf, size_t len);
+int http_str_eq(http_str s, const char *lit);
+int http_request_keep_alive(http_request *req);
+int http_request_hop(http_request *req, http_header *h);
+int http_request_origin(http_request *req, char *hostname, size_t hostlen, char *port, size_t portlen);
+int http_request_key(http_request *req, char *key, size_t size);
+int http_path_slash(http_request *req);
+int http_request_conditional(http_request *req);
+int http_request_credentials(http_request *req);
+void http_response_init(http_response *resp, int head_request, int credentials);
+size_t http_response_feed(http_response *resp, const char *buf, size_t n);
+int http_response_complete(http_response *resp, int eof);
+void http_response_skip(http_response *resp, size_t n);
+size_t http_response_merge(const char *stored, size_t stored_size, const char *head, size_t head_len,
+                           char *out, size_t size, size_t *body);
+int http_response_validators(char *response, size_t size, http_validators *v);
+
+#endif /* __HTTP_H__ */
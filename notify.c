@@ -0,0 +1,45 @@
+/*
+ * notify.c - Cross-thread wakeups for the event loops. A connection that
+ *     waits on another thread (a DNS lookup, another request's fetch)
+ *     parks with a notice; the other thread posts it to the loop's
+ *     notifier, and the eventfd wakes the loop to take it.
+ */
+#include <sys/eventfd.h>
+#include "notify.h"
+
+/* Set up n, whose efd the loop then watches */
+void notifier_init(notifier *n) {
+    if ((n->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        unix_error("eventfd error");
+    pthread_mutex_init(&n->lock, NULL);
+    n->posted = NULL;
+}
+
+/* Hand e to its loop; callable from any thread */
+void notice_post(notice *e) {
+    notifier *n = e->notifier;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&n->lock);
+    e->next = n->posted;
+    n->posted = e;
+    pthread_mutex_unlock(&n->lock);
+    if (write(n->efd, &one, sizeof(one)) < 0)
+        unix_error("eventfd write error");
+}
+
+/* Take every notice posted to n since the last call */
+notice *notifier_take(notifier *n) {
+    notice *list;
+    uint64_t count;
+
+    // Reset the eventfd before taking the list, so a later post wakes the loop again
+    if (read(n->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        unix_error("eventfd read error");
+
+    pthread_mutex_lock(&n->lock);
+    list = n->posted;
+    n->posted = NULL;
+    pthread_mutex_unlock(&n->lock);
+    return list;
+}
@@ -0,0 +1,26 @@
+#ifndef __NOTIFY_H__
+#define __NOTIFY_H__
+
+#include "csapp.h"
+
+// Wakeup for a connection parked on an event loop, posted by whichever
+// thread finishes what the connection is waiting for
+typedef struct notice {
+    void *data;                   // The loop's context, e.g. its connection
+    struct notifier *notifier;    // Loop to wake
+    struct notice *next;          // Link in a wait list, then in the posted list
+} notice;
+
+// Per event loop: posted notices, signalled through an eventfd the loop watches
+typedef struct notifier {
+    int efd;                      // Readable once posted is non-empty
+    pthread_mutex_t lock;         // Guards posted
+    notice *posted;
+} notifier;
+
+/* Function Prototypes */
+void notifier_init(notifier *n);
+void notice_post(notice *e);
+notice *notifier_take(notifier *n);
+
+#endif /* __NOTIFY_H__ */
@@ -1,258 +1,648 @@
+#include <poll.h>
+#include <stdint.h>
 #include "csapp.h"
+#include "cache.h"
+#include "proxy.h"
+#include "reactor.h"
+#include "uring.h"
+#include "sbuf.h"
+#include "http.h"
+#include "upstream.h"
+#include "dns.h"
+#include "flight.h"
 
-#define MAX_CACHE_SIZE 1049000  // Maximum cache size (in bytes)
-#define MAX_OBJECT_SIZE 102400  // Maximum size for an individual object (in bytes)
-// Cache block structure
-typedef struct {
-    char uri[MAXLINE];           // Key: URI of the request
-    char response[MAX_OBJECT_SIZE];  // Value: Server's response (binary data)
-    size_t size;                 // Size of the stored response
-    int lru_count;               // Least Recently Used count for eviction
-} cache_block;
-// Cache structure
-typedef struct {
-    cache_block *blocks;  // Pointer to dynamically allocated cache blocks
-    int cache_cnt;      // Number of cache entries currently in use
-    int lru_tracker;      // Track the least recently used entries
-    size_t current_cache_size;  // Total size of cached objects (in bytes)
-} Cache;
-// Global cache variable
-Cache cache;
+#define NTHREADS 16  // Default number of worker threads (-t)
+#define SBUFSIZE 64  // Default depth of the accepted-connection queue (-q)
+#define SPLICE_CHUNK 65536  // Bytes moved per splice(), the default pipe capacity
+#define KEEPALIVE_TIMEOUT 5  // Default seconds an idle client connection is kept (-k)
+
+sbuf_t sbuf;  // Shared buffer of connected descriptors
+int event_mode = 0;  // Run an epoll reactor per listener instead of feeding the pool
+int uring_mode = 0;  // Likewise, but an io_uring instance per listener
+int keepalive_timeout = KEEPALIVE_TIMEOUT;  // 0 closes client connections after one response
+int max_idle_workers;  // Workers that may wait on an idle client at once: half the pool
+static int idle_workers;  // Workers waiting on an idle client now
 
 /* Function Prototypes */
-void cache_init(void);
-int cache_find(char *uri, char *response, size_t *response_size);
-void cache_store(char *uri, char *response, size_t size);
-void cache_evict(void);
 void doit(int clientfd);
-void parse_uri(char *uri, char *hostname, char *port, char *path);
-void makeHTTPheader(char *http_header, char *hostname, char *path, char *port, rio_t *client_rio);
-void *thread(void *connfdp);
-
-/* Initialize the cache */
-void cache_init(void) {
-    cache.cache_cnt = 0;  
-    cache.lru_tracker = 0;  
-    cache.current_cache_size = 0;  // Initialize the total cache size to 0
-
-    // Dynamically allocate memory for cache blocks based on the number of entries we need.
-    int num_cache_blocks = MAX_CACHE_SIZE / MAX_OBJECT_SIZE;  // Calculate the number of cache blocks we can have
-    cache.blocks = (cache_block *)Malloc(sizeof(cache_block) * num_cache_blocks);
-    
-    if (cache.blocks == NULL) {
-        fprintf(stderr, "Cache initialization failed: insufficient memory\n");
-        exit(1);
-    }
+int wait_for_request(rio_t *rp, int first);
+int serve_request(int clientfd, rio_t *rp);
+int serve_cached(int clientfd, cache_block *cached, int keep_alive);
+int follow(int clientfd, flight *f, int keep_alive);
+int fetch(int clientfd, int serverfd, int reused, http_request *req, http_validators *v,
+          http_response *resp, flight *f, char *cache_buf, size_t *total_bytes);
+int splice_body(int clientfd, int serverfd, http_response *resp, size_t *total_bytes, int *eof);
+void *thread(void *vargp);
+void *listener(void *vargp);
+void serve(int listenfd);
+size_t parse_size(char *arg);
+void usage(char *prog);
 
-    // Initialize each cache block's size and LRU count
-    for (int i = 0; i < num_cache_blocks; i++) {
-        cache.blocks[i].size = 0;
-        cache.blocks[i].lru_count = 0;
-    }
+/* Proxy server main request handler: serve every request the client sends on clientfd */
+void doit(int clientfd) {
+    rio_t request_rio;
+    int first = 1;
+
+    // Initialize the request buffer; it carries pipelined requests over between iterations
+    Rio_readinitb(&request_rio, clientfd);
+    while (wait_for_request(&request_rio, first) && serve_request(clientfd, &request_rio))
+        first = 0;
 }
-/* Clean up cache memory */
-void cache_cleanup(void) {
-    if (cache.blocks) {
-        free(cache.blocks);
+
+/*
+ * Wait for the client's next request, or its first one if first is set;
+ * returns 0 if it stays idle past the keep-alive timeout. A worker waiting
+ * here serves no one else, so once half the pool is waiting, a client
+ * idle after a response is closed instead and the worker goes back to the
+ * queue of new connections.
+ */
+int wait_for_request(rio_t *rp, int first) {
+    struct pollfd pfd = {rp->rio_fd, POLLIN, 0};
+    int rc;
+
+    if (rp->rio_cnt > 0)
+        return 1;  // A pipelined request is already buffered
+    while ((rc = poll(&pfd, 1, 0)) < 0 && errno == EINTR)
+        ;
+    if (rc != 0)
+        return rc > 0;  // The next request has already arrived
+    if (__atomic_add_fetch(&idle_workers, 1, __ATOMIC_RELAXED) > max_idle_workers && !first) {
+        __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_RELAXED);
+        return 0;
     }
+    while ((rc = poll(&pfd, 1, keepalive_timeout > 0 ? keepalive_timeout * 1000 : -1)) < 0 && errno == EINTR)
+        ;
+    __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_RELAXED);
+    return rc > 0;
 }
-/* Search for a URI in the cache */
-int cache_find(char *uri, char *response, size_t *response_size) {
-    for (int i = 0; i < cache.cache_cnt; i++) {
-        if (strcmp(cache.blocks[i].uri, uri) == 0) {  // URI match
-            // Copy the cached binary response data into the output buffer
-            memcpy(response, cache.blocks[i].response, cache.blocks[i].size);
-            *response_size = cache.blocks[i].size;  // Return the size of the cached response
-            cache.blocks[i].lru_count = ++cache.lru_tracker;  // Update LRU count
-            return 1;  // Cache hit
+
+/* Serve one request from rp; returns 1 if the connection stays open for another */
+int serve_request(int clientfd, rio_t *rp) {
+    int serverfd, reused, reusable, rc, keep_alive, leader, stale;
+    char hostname[NI_MAXHOST], port[NI_MAXSERV], uri[MAXLINE];
+    char *cache_buf;
+    cache_block *cached, *refreshed = NULL;
+    flight *f;
+    http_validators validators, *v = NULL;
+    http_request req;
+    http_response resp;
+    size_t total_bytes;
+
+    // Parse the request head in place in the rio buffer, reading until all of it is there
+    while ((rc = http_parse_request(&req, rp->rio_bufptr, rp->rio_cnt)) == HTTP_PARSE_INCOMPLETE)
+        if (rio_fillmoreb(rp) <= 0)
+            return 0;
+    if (rc < 0)
+        return 0;
+    rp->rio_bufptr += rc;  // Consumed; req stays valid until the next read from rp
+    rp->rio_cnt -= rc;
+    printf("Request headers:\n %.*s %s %.*s\n", (int)req.method.len, req.method.p, req.uri.p,
+           (int)req.version.len, req.version.p);
+
+    /*Only handle GET and HEAD methods*/
+    if (!http_str_eq(req.method, "GET") && !http_str_eq(req.method, "HEAD")) {
+        printf("Proxy does not implement this method\n");
+        return 0;
+    }
+
+    // Cache and flights are keyed by the full URI, whichever form the request used
+    if (http_request_key(&req, uri, sizeof(uri)) < 0)
+        return 0;
+
+    // The origin is always sent a GET, so a HEAD client gets a body it cannot delimit
+    keep_alive = http_request_keep_alive(&req);
+    if (http_str_eq(req.method, "HEAD") || keepalive_timeout == 0)
+        keep_alive = 0;
+
+    // Check if the URI response is cached. A stale copy with validators is
+    // kept while the origin is asked whether it changed, unless the client
+    // sent conditions or ranges of its own for the origin to judge
+    if ((cached = cache_find(uri, &stale)) != NULL) {
+        if (!stale)
+            return serve_cached(clientfd, cached, keep_alive);
+        if (!http_request_conditional(&req) && http_response_validators(cached->response, cached->local_size, &validators)) {
+            v = &validators;
+        } else {
+            cache_release(cached);
+            cached = NULL;
         }
     }
-    return 0;  // Cache miss
-}
 
-/* Store a new response in the cache */
-void cache_store(char *uri, char *response, size_t size) {
-    if (size > MAX_OBJECT_SIZE) {
-        printf("Object too large to cache\n");
-        return;
+    if (http_request_origin(&req, hostname, sizeof(hostname), port, sizeof(port)) < 0) {
+        if (cached)
+            cache_release(cached);
+        return 0;
     }
 
-    // Ensure the total cache size doesn't exceed MAX_CACHE_SIZE
-    while (cache.current_cache_size + size > MAX_CACHE_SIZE) {
-        cache_evict();  // Evict the least recently used cache block
+    // If another request is already fetching this URI, relay its response
+    // as it arrives; only one the cache would not keep is fetched twice.
+    // A request with credentials neither shares its answer nor takes another's
+    f = NULL;
+    if (!http_request_credentials(&req)) {
+        f = flight_join(uri, &leader);
+        if (!leader) {
+            rc = follow(clientfd, f, keep_alive);
+            flight_release(f);
+            // A flight that refreshed a stale copy lands with the result in the cache
+            if (rc < 0 && (refreshed = cache_find(uri, NULL)) != NULL)
+                rc = serve_cached(clientfd, refreshed, keep_alive);
+            if (rc >= 0) {
+                if (cached)
+                    cache_release(cached);
+                return rc;
+            }
+            f = NULL;
+        }
     }
 
-    // Store the new entry in the next available cache block
-    strcpy(cache.blocks[cache.cache_cnt].uri, uri);  // Store the URI
-    memcpy(cache.blocks[cache.cache_cnt].response, response, size);  // Store the response
-    cache.blocks[cache.cache_cnt].size = size;  // Store the size
-    cache.blocks[cache.cache_cnt].lru_count = ++cache.lru_tracker;  // Update LRU count
-
-    // Update the total cache size
-    cache.current_cache_size += size;
-    
-    // Increment the cache count
-    cache.cache_cnt++;
-}
+    // Connect to the server; the leader reads into the flight so followers can share it
+    cache_buf = f ? f->data : Malloc(MAX_OBJECT_SIZE);  // Heap, not stack: only misses need it
 
-/* Evict the least recently used cache block */
-void cache_evict(void) {
-    if (cache.cache_cnt == 0) return;  // No need to evict if the cache is empty
+    do {
+        // Prefer an idle keep-alive connection to the same origin
+        reused = (serverfd = upstream_take(hostname, port)) >= 0;
+        if (!reused && (serverfd = dns_open_clientfd(hostname, port)) < 0) {
+            printf("Failed to connect to the end server\n");
+            if (f) {
+                flight_land(f, 0);
+                flight_release(f);
+            } else {
+                Free(cache_buf);
+            }
+            if (cached)
+                cache_release(cached);
+            return 0;
+        }
+        total_bytes = 0;
+        if ((rc = fetch(clientfd, serverfd, reused, &req, v, &resp, f, cache_buf, &total_bytes)) < 0)
+            Close(serverfd);  // The pooled connection had gone stale; try again
+    } while (rc < 0);
+
+    reusable = resp.state == RESP_DONE && resp.keep_alive;
 
-    int lru_index = 0;
-    int min_lru = cache.blocks[0].lru_count;
+    // A 304 confirms the stale copy. The client gets the stored response
+    // with the 304's headers merged in, from the entry that now replaces
+    // the copy and shares its body; there is nothing more to store, and
+    // the flight lands without data, so followers look in the cache
+    if (cached && rc && resp.status == 304) {
+        if ((refreshed = revalidate_response(cached, cache_buf, total_bytes, &resp)) == NULL) {
+            refreshed = cached;  // Sent as it was
+            cached = NULL;
+        }
+        rc = 0;
+    }
+    if (cached)
+        cache_release(cached);
 
-    // Find the block with the lowest LRU count (least recently used)
-    for (int i = 1; i < cache.cache_cnt; i++) {
-        if (cache.blocks[i].lru_count < min_lru) {
-            lru_index = i;
-            min_lru = cache.blocks[i].lru_count;
+    // Cache the response if it is complete, within the limit, and its
+    // headers allow a shared cache to reuse it
+    rc = rc && resp.fresh_until && total_bytes <= MAX_OBJECT_SIZE;
+    if (rc) {
+        cache_store(uri, cache_buf, total_bytes, resp.fresh_until);
+    }
+    if (f) {
+        // Store first: once the flight lands, new misses look in the cache
+        if (!f->landed) {
+            if (rc)
+                flight_publish(f, total_bytes);
+            flight_land(f, rc);
         }
+        flight_release(f);
+    } else {
+        Free(cache_buf);
     }
 
-    // Evict the block with the lowest LRU count
-    printf("Evicting cache entry: %s\n", cache.blocks[lru_index].uri);
-    // Update the total cache size
-    cache.current_cache_size -= cache.blocks[lru_index].size;
-    // Shift remaining cache blocks to remove the least used one
-    for (int i = lru_index; i < cache.cache_cnt - 1; i++) {
-        cache.blocks[i] = cache.blocks[i + 1];}
-    // Decrease the cache count
-    cache.cache_cnt--;
+    // Keep the connection for the next request to this origin if it allows that
+    if (reusable)
+        upstream_give(hostname, port, serverfd);
+    else
+        Close(serverfd);
+
+    if (refreshed)
+        return serve_cached(clientfd, refreshed, keep_alive);
+
+    // A response that ran until the origin closed can only end the same way for the client
+    return keep_alive && resp.state == RESP_DONE;
 }
 
-/* Proxy server main request handler (doit function) */
-void doit(int clientfd) {
-    int serverfd;
-    char request_buf[MAXLINE], response_buf[MAXLINE], HTTPheader[MAXLINE];
-    char method[MAXLINE], uri[MAXLINE], path[MAXLINE], hostname[MAXLINE], port[MAXLINE];
-    char cache_buf[MAX_OBJECT_SIZE], cached_response[MAX_OBJECT_SIZE];
-    rio_t request_rio, response_rio;
-    size_t bytes, total_bytes = 0, cached_response_size;
-
-    // Initialize the request buffer
-    Rio_readinitb(&request_rio, clientfd);
-    Rio_readlineb(&request_rio, request_buf, MAXLINE);
-    printf("Request headers:\n %s", request_buf);
-    sscanf(request_buf, "%s %s", method, uri);
+/* Send a cached response straight from its block; returns 1 if the connection stays open */
+int serve_cached(int clientfd, cache_block *cached, int keep_alive) {
+    struct iovec iov[2];
+    int iovcnt = cache_iov(cached, 0, iov);
+    http_response resp;
 
-    /*Only handle GET and HEAD methods*/
-    if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) {
-        printf("Proxy does not implement this method\n");
-        return;
+    printf("Serving from cache: %s\n", cached->uri);
+    if (keep_alive) {
+        // Only a response that delimits itself lets the client find the next one
+        http_response_init(&resp, 0, 0);
+        for (int i = 0; i < iovcnt; i++)
+            http_response_feed(&resp, iov[i].iov_base, iov[i].iov_len);
+        keep_alive = resp.state == RESP_DONE;
     }
+    if (rio_writev(clientfd, iov, iovcnt) < 0)
+        keep_alive = 0;
+    cache_release(cached);
+    return keep_alive;
+}
+
+/*
+ * Relay the response f's leader is fetching, each part as soon as it is
+ * published. Returns 1 if the connection stays open, 0 if not, or -1 if
+ * the flight landed without sending anything, leaving the fetch to us.
+ */
+int follow(int clientfd, flight *f, int keep_alive) {
+    http_response resp;
+    size_t off = 0, size;
+
+    printf("Following the fetch of %s\n", f->uri);
+    http_response_init(&resp, 0, 0);
+    while ((size = flight_wait(f, off)) > off) {
+        http_response_feed(&resp, f->data + off, size - off);
+        if (rio_writen(clientfd, f->data + off, size - off) < 0)
+            return 0;
+        off = size;
+    }
+
+    // Landed with nothing more to send
+    if (!f->complete)
+        return off ? 0 : -1;
+    return keep_alive && resp.state == RESP_DONE;
+}
 
-    // Check if the URI response is cached
-    if (cache_find(uri, cached_response, &cached_response_size)) {
-        printf("Serving from cache: %s\n", uri);
-        Rio_writen(clientfd, cached_response, cached_response_size);  // Send cached response
-        return;
+/*
+ * Pass the first total_bytes of the response f's leader is reading into
+ * f->data on to the followers. Nothing is published until the response
+ * is known to be cacheable and to fit in the cache, so followers never
+ * relay another client's private response, nor one they would have to
+ * cut short; a chunked or unsized one waits until it is complete. Once
+ * it cannot be cached, f lands so the followers fetch it themselves.
+ * Returns 0 if f has landed.
+ */
+int share_response(flight *f, http_response *resp, size_t total_bytes) {
+    if (f->landed)
+        return 0;
+    if (resp->state == RESP_STATUS || resp->state == RESP_HEADERS)
+        return 1;  // Status and length not known yet
+    if (resp->status == 304)
+        return 1;  // Revalidated: the leader lands f once the refreshed entry is in the cache
+
+    if (!resp->fresh_until || total_bytes > MAX_OBJECT_SIZE ||
+        (resp->state == RESP_BODY && total_bytes + resp->remaining > MAX_OBJECT_SIZE)) {
+        flight_land(f, 0);
+        return 0;
     }
+    if (resp->state == RESP_BODY || resp->state == RESP_DONE)
+        flight_publish(f, total_bytes);
+    return 1;
+}
 
-    // Parse the URI, prepare headers, and connect to the server
-    parse_uri(uri, hostname, port, path);
-    makeHTTPheader(HTTPheader, hostname, path, port, &request_rio);
-    serverfd = Open_clientfd(hostname, port);
+/*
+ * The origin answered the revalidation of stale with a 304, whose head
+ * is the first head_len bytes of head. Refresh the entry with the stored
+ * head updated by the 304's headers, parsed into resp, in front of the
+ * stored body, which is neither fetched again nor copied. Returns the
+ * new entry with a reference held for the caller, or NULL if the updated
+ * head cannot be built; then the stored response goes out as it was.
+ */
+cache_block *revalidate_response(cache_block *stale, const char *head, size_t head_len, http_response *resp) {
+    int credentials = resp->credentials;
+    size_t max = stale->local_size + head_len, size, body;
+    char *merged = Malloc(max);
+    cache_block *block = NULL;
 
-    if (serverfd < 0) {
-        printf("Failed to connect to the end server\n");
-        return;
+    if ((size = http_response_merge(stale->response, stale->local_size, head, head_len, merged, max, &body)) > 0) {
+        http_response_init(resp, 0, credentials);
+        http_response_feed(resp, merged, size);
+        block = cache_refresh(stale, merged, size, body, resp->fresh_until);
     }
+    Free(merged);
+    return block;
+}
+
+/*
+ * Send req to the origin over serverfd and relay the response to the
+ * client, keeping a copy in cache_buf while it fits and sharing it with
+ * f's followers if f is not NULL. Returns 1 if the response arrived in
+ * full, 0 if it was cut short, and -1 if serverfd was a pooled
+ * connection that turned out to be dead before any byte of the response
+ * came back. While followers share the response, it is read to the end
+ * even if the client goes away. With validators v from a stale copy the
+ * request is conditional: the response head is held back until it shows
+ * whether the copy is still current, and a 304 goes no further.
+ */
+int fetch(int clientfd, int serverfd, int reused, http_request *req, http_validators *v,
+          http_response *resp, flight *f, char *cache_buf, size_t *total_bytes) {
+    struct iovec iov[HTTP_MAX_IOV];
+    char response_buf[MAXLINE];
+    ssize_t bytes;
+    size_t used;
+    int eof = 0;
 
-    // Forward the request to the server
-    Rio_readinitb(&response_rio, serverfd);
-    Rio_writen(serverfd, HTTPheader, strlen(HTTPheader));
+    http_response_init(resp, 0, http_request_credentials(req));
+    if (rio_writev(serverfd, iov, build_http_header(iov, req, v)) < 0)
+        return reused ? -1 : 0;
 
-    // Read the server's response and simultaneously cache and forward it
-    while ((bytes = Rio_readnb(&response_rio, response_buf, MAXLINE)) > 0) {
+    // Read the server's response and simultaneously cache and forward it,
+    // stopping where the response ends so the connection can be reused
+    while (!http_response_complete(resp, 0)) {
+        // A body that can no longer be cached bypasses user space
+        if ((resp->state == RESP_BODY && *total_bytes + resp->remaining > MAX_OBJECT_SIZE) ||
+            (resp->state == RESP_UNTIL_EOF && *total_bytes > MAX_OBJECT_SIZE)) {
+            int rc = splice_body(clientfd, serverfd, resp, total_bytes, &eof);
+            if (rc < 0)
+                return 0;  // Client went away
+            if (rc > 0)
+                break;
+        }
+        if ((bytes = read(serverfd, response_buf, MAXLINE)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (bytes == 0) {
+            eof = 1;
+            break;
+        }
+        used = http_response_feed(resp, response_buf, bytes);
         // Ensure that we do not exceed the cache buffer size
-        if (total_bytes + bytes <= MAX_OBJECT_SIZE) {
-            memcpy(cache_buf + total_bytes, response_buf, bytes);  // Append to cache buffer
+        if (*total_bytes + used <= MAX_OBJECT_SIZE) {
+            memcpy(cache_buf + *total_bytes, response_buf, used);  // Append to cache buffer
+        }
+        *total_bytes += used;
+        if (f && !share_response(f, resp, *total_bytes))
+            f = NULL;
+        if (v) {
+            if (resp->state == RESP_STATUS || resp->state == RESP_HEADERS) {
+                if (*total_bytes > MAX_OBJECT_SIZE)
+                    return 0;  // A head too large to hold
+                continue;
+            }
+            v = NULL;
+            if (resp->status == 304)
+                continue;  // The caller sends the stored copy instead
+            // Changed: the held head goes out ahead of the body
+            if (clientfd >= 0 && rio_writen(clientfd, cache_buf, *total_bytes) < 0)
+                clientfd = -1;
+        } else if (clientfd >= 0 && rio_writen(clientfd, response_buf, used) < 0) {
+            clientfd = -1;
         }
-        total_bytes += bytes;
-        Rio_writen(clientfd, response_buf, bytes);  // Send response to client
+        if (clientfd < 0 && !f)
+            return 0;  // Client went away, and no follower needs the rest
     }
 
-    // Cache the response if the size is within the limit
-    if (total_bytes <= MAX_OBJECT_SIZE) {
-        cache_store(uri, cache_buf, total_bytes);
-    }
+    if (*total_bytes == 0 && reused)
+        return -1;
+    return http_response_complete(resp, eof);
+}
+
+/*
+ * Relay the rest of a Content-Length or read-until-close body from
+ * serverfd to clientfd through a pipe, so it never enters user space.
+ * Returns 1 when the body is done or the origin failed (*eof is set if
+ * it closed), -1 if the client went away, and 0 if splice() is not
+ * available and the caller should copy instead.
+ */
+int splice_body(int clientfd, int serverfd, http_response *resp, size_t *total_bytes, int *eof) {
+    static __thread int pipefd[2] = {-1, -1};  // Reused by each worker thread
+    ssize_t n, m;
+    size_t want;
 
-    Close(serverfd);
+    if (pipefd[0] < 0 && pipe(pipefd) < 0)
+        return 0;
+
+    while (!http_response_complete(resp, 0)) {
+        want = SPLICE_CHUNK;
+        if (resp->state == RESP_BODY && resp->remaining < SPLICE_CHUNK)
+            want = resp->remaining;
+        if ((n = splice(serverfd, NULL, pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        if (n == 0) {
+            *eof = 1;
+            return 1;
+        }
+        http_response_skip(resp, n);
+        *total_bytes += n;
+
+        // Drain the pipe into the client socket
+        while (n > 0) {
+            if ((m = splice(pipefd[0], NULL, clientfd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                // Bytes left in the pipe would leak into the next response
+                close(pipefd[0]);
+                close(pipefd[1]);
+                pipefd[0] = pipefd[1] = -1;
+                return -1;
+            }
+            n -= m;
+        }
+    }
+    return 1;
 }
-/*URI parsing*/
-void parse_uri(char *uri, char *hostname, char *port, char *path)
-{
-    char *hostname_ptr = strstr(uri, "//") ? strstr(uri, "//") + 2 : uri;
-    char *path_ptr = strchr(hostname_ptr, '/');
-    char *port_ptr = strchr(hostname_ptr, ':');
-    
-    if (path_ptr)
-        strcpy(path, path_ptr);
-    else
-        strcpy(path, "/");
 
-    if (port_ptr) {
-        strncpy(port, port_ptr + 1, path_ptr - port_ptr - 1);
-        strncpy(hostname, hostname_ptr, port_ptr - hostname_ptr);
-    } else {
-        strcpy(port, "80");
-        strncpy(hostname, hostname_ptr, path_ptr - hostname_ptr);
+/*
+ * Build the request sent upstream as iov, which needs HTTP_MAX_IOV
+ * entries; returns how many it used. Fixed strings replace the request
+ * line, Host and the proxy's own headers, and every end-to-end client
+ * header is forwarded as a slice of the buffer req was parsed from. If v
+ * is not NULL, the request is made conditional on a stale copy's
+ * validators, which are sent from the cache block without copying.
+ */
+int build_http_header(struct iovec *iov, http_request *req, http_validators *v) {
+    static char get[] = "GET /", version[] = " HTTP/1.1\r\n", host_name[] = "Host: ", crlf[] = "\r\n";
+    static char if_none_match[] = "If-None-Match: ", if_modified_since[] = "If-Modified-Since: ";
+    static char tail[] = "Connection: keep-alive\r\nProxy-Connection: keep-alive\r\n"
+                         "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n\r\n";
+    http_str host = req->known[HDR_HOST] >= 0 ? req->headers[req->known[HDR_HOST]].value : req->host;
+    int n = 0;
+
+    iov[n++] = (struct iovec){get, sizeof(get) - 1 - !http_path_slash(req)};
+    iov[n++] = (struct iovec){req->path.p, req->path.len};
+    iov[n++] = (struct iovec){version, sizeof(version) - 1};
+    iov[n++] = (struct iovec){host_name, sizeof(host_name) - 1};
+    iov[n++] = (struct iovec){host.p, host.len};
+    iov[n++] = (struct iovec){crlf, sizeof(crlf) - 1};
+    for (int i = 0; i < req->header_count; i++) {
+        http_header *h = &req->headers[i];
+        if (h->id == HDR_HOST || h->id == HDR_USER_AGENT || http_request_hop(req, h))
+            continue;
+        // "Name: value" is contiguous in the client's buffer
+        iov[n++] = (struct iovec){h->name.p, h->value.p + h->value.len - h->name.p};
+        iov[n++] = (struct iovec){crlf, sizeof(crlf) - 1};
+    }
+    if (v && v->etag.len) {
+        iov[n++] = (struct iovec){if_none_match, sizeof(if_none_match) - 1};
+        iov[n++] = (struct iovec){v->etag.p, v->etag.len};
+        iov[n++] = (struct iovec){crlf, sizeof(crlf) - 1};
     }
+    if (v && v->last_modified.len) {
+        iov[n++] = (struct iovec){if_modified_since, sizeof(if_modified_since) - 1};
+        iov[n++] = (struct iovec){v->last_modified.p, v->last_modified.len};
+        iov[n++] = (struct iovec){crlf, sizeof(crlf) - 1};
+    }
+    iov[n++] = (struct iovec){tail, sizeof(tail) - 1};
+    return n;
 }
 
-/*HTTP header generation*/
-void makeHTTPheader(char *http_header, char *hostname, char *path, char *port, rio_t *client_rio) {
-    char buf[MAXLINE], request_header[MAXLINE], other_header[MAXLINE], host_header[MAXLINE];
-    sprintf(request_header, "GET %s HTTP/1.0\r\n", path);
-    while (Rio_readlineb(client_rio, buf, MAXLINE) > 0) {
-        if (strcmp(buf, "\r\n") == 0)
-            break;
-        if (!strncasecmp(buf, "Host:", strlen("Host:"))) {
-            strcpy(host_header, buf);
-            continue;}
-        if (!strncasecmp(buf, "Connection:", strlen("Connection")) || 
-            !strncasecmp(buf, "Proxy-Connection:", strlen("Proxy-Connection")) || 
-            !strncasecmp(buf, "User-Agent:", strlen("User-Agent"))) {
-            strcat(other_header, buf);}}
-    if (strlen(host_header) == 0) {
-        sprintf(host_header, "Host: %s\r\n", hostname);}
-    sprintf(http_header, "%s%sConnection: close\r\nProxy-Connection: close\r\nUser-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n\r\n", request_header, host_header);
+/*Worker thread routine: serve connections taken from the shared queue*/
+void *thread(void *vargp) {
+    Pthread_detach(pthread_self());
+    while (1) {
+        int connfd = sbuf_remove(&sbuf);
+        doit(connfd);
+        Close(connfd);
+    }
+    return NULL;
 }
 
-/*Thread routine*/
-void *thread(void *connfdp) {
-    int connfd = *((int *)connfdp);
+/*Listener thread routine: serve one SO_REUSEPORT listening socket*/
+void *listener(void *vargp) {
     Pthread_detach(pthread_self());
-    Free(connfdp);
-    doit(connfd);
-    Close(connfd);
+    serve((int)(long)vargp);
     return NULL;
 }
 
-/*Main function*/
-int main(int argc, char **argv) {
-    int listenfd, *connfdp;
+/*Accept loop for one listening socket; never returns*/
+void serve(int listenfd) {
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
     char hostname[MAXLINE], port[MAXLINE];
-    pthread_t tid;
+    int connfd;
+
+    if (event_mode)
+        reactor_run(listenfd);  // Never returns
+    if (uring_mode)
+        uring_run(listenfd);    // Never returns
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-        exit(1);}
-    // Initialize the cache
-    cache_init();
-    // Open the listening socket
-    listenfd = Open_listenfd(argv[1]);
     while (1) {
         clientlen = sizeof(clientaddr);
-        connfdp = Malloc(sizeof(int));
-        *connfdp = Accept(listenfd, (SA *)&clientaddr, &clientlen);
+        if ((connfd = accept4(listenfd, (SA *)&clientaddr, &clientlen, SOCK_CLOEXEC)) < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                fprintf(stderr, "accept4 error: %s\n", strerror(errno));
+            continue;}
         Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
         printf("Accepted connection from %s:%s\n", hostname, port);
-        Pthread_create(&tid, NULL, thread, connfdp);}
-    
+        sbuf_insert(&sbuf, connfd);}
+}
+
+/*Parse a byte count with an optional K, M or G suffix; returns 0 if malformed or too big for a size_t*/
+size_t parse_size(char *arg) {
+    char *end;
+    unsigned long long size;
+    int shift;
+
+    if (!isdigit((unsigned char)*arg))
+        return 0;  // strtoull would take a sign or leading spaces
+    errno = 0;
+    size = strtoull(arg, &end, 10);
+    if (errno == ERANGE)
+        return 0;
+    switch (toupper((unsigned char)*end)) {
+    case 'G': shift = 30; end++; break;
+    case 'M': shift = 20; end++; break;
+    case 'K': shift = 10; end++; break;
+    case '\0': shift = 0; break;
+    default: return 0;
+    }
+    if (*end || size > SIZE_MAX >> shift)
+        return 0;
+    return (size_t)size << shift;
+}
+
+void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-c cache_bytes] [-p lru|tinylfu|gdsf|gdsf-bytes|arc] [-s stats_seconds] [-f default_lifetime] [-e | -u] [-t threads] [-q queue_depth] [-r listeners] [-k idle_seconds] <port>\n", prog);
+    exit(1);
+}
+
+/*Main function*/
+int main(int argc, char **argv) {
+    int listenfd, opt;
+    pthread_t tid;
+    size_t cache_size = MAX_CACHE_SIZE;
+    int nthreads = NTHREADS, queue_depth = SBUFSIZE, listeners = 0;
+    const cache_policy *policy = cache_policy_by_name("lru");
+    int stats_interval = CACHE_STATS_INTERVAL;
+
+    while ((opt = getopt(argc, argv, "c:p:s:f:eut:q:r:k:")) != -1) {
+        switch (opt) {
+        case 'c':  // Cache budget in bytes, e.g. -c 512M
+            if ((cache_size = parse_size(optarg)) == 0) {
+                fprintf(stderr, "Invalid cache size: %s\n", optarg);
+                usage(argv[0]);}
+            break;
+        case 'p':  // Cache eviction policy: lru, tinylfu, gdsf, gdsf-bytes or arc
+            if ((policy = cache_policy_by_name(optarg)) == NULL) {
+                fprintf(stderr, "Unknown cache policy: %s\n", optarg);
+                exit(1);}
+            break;
+        case 's':  // Seconds between cache statistics reports on stdout; 0 = none
+            if ((stats_interval = atoi(optarg)) < 0)
+                usage(argv[0]);
+            break;
+        case 'f':  // Seconds a 200 without explicit freshness stays cached at least; 0 = only by Last-Modified
+            if ((http_default_lifetime = atoi(optarg)) < 0)
+                usage(argv[0]);
+            break;
+        case 'e':  // Event-driven epoll reactor instead of the worker pool
+            event_mode = 1;
+            break;
+        case 'u':  // io_uring completion loop instead of the worker pool
+            uring_mode = 1;
+            break;
+        case 't':  // Worker threads in the pool
+            if ((nthreads = atoi(optarg)) < 1)
+                usage(argv[0]);
+            break;
+        case 'q':  // Accepted connections that may wait for a worker
+            if ((queue_depth = atoi(optarg)) < 1)
+                usage(argv[0]);
+            break;
+        case 'r':  // SO_REUSEPORT listeners, each with its own thread; 0 = one per core
+            if ((listeners = atoi(optarg)) < 0)
+                usage(argv[0]);
+            if (listeners == 0)
+                listeners = sysconf(_SC_NPROCESSORS_ONLN);
+            break;
+        case 'k':  // Seconds a client connection may sit idle between requests; 0 = no keep-alive
+            if ((keepalive_timeout = atoi(optarg)) < 0)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);}}
+    if (optind != argc - 1)
+        usage(argv[0]);
+    // Initialize the cache and the origin connection pool
+    cache_init(cache_size, policy);
+    cache_stats_start(stats_interval);
+    upstream_init();
+    Signal(SIGPIPE, SIG_IGN);  // A peer closing mid-write must not kill the proxy
+
+    // Pre-spawn the workers; the queue blocks the acceptors once it is full.
+    // Workers resolve origins themselves; event loops hand lookups to dns.c
+    if (!event_mode && !uring_mode) {
+        sbuf_init(&sbuf, queue_depth);
+        max_idle_workers = nthreads / 2;
+        for (int i = 0; i < nthreads; i++)
+            Pthread_create(&tid, NULL, thread, NULL);
+    } else {
+        dns_init();
+    }
+
+    if (listeners == 0) {
+        // Open the listening socket
+        listenfd = Open_listenfd(argv[optind]);
+    } else {
+        // One listener per thread so the kernel balances connections across
+        // their accept queues; this thread serves the last one
+        for (int i = 1; i < listeners; i++)
+            Pthread_create(&tid, NULL, listener, (void *)(long)Open_reuseport_listenfd(argv[optind]));
+        listenfd = Open_reuseport_listenfd(argv[optind]);
+    }
+    serve(listenfd);
+
     // Free cache memory when program exits
     // cache_cleanup();
     return 0;
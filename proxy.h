@@ -0,0 +1,14 @@
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include "csapp.h"
+#include "http.h"
+#include "flight.h"
+#include "cache.h"
+
+/* Request helpers shared by the threaded and event-driven front ends */
+int build_http_header(struct iovec *iov, http_request *req, http_validators *v);
+int share_response(flight *f, http_response *resp, size_t total_bytes);
+cache_block *revalidate_response(cache_block *stale, const char *head, size_t head_len, http_response *resp);
+
+#endif /* __PROXY_H__ */
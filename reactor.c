@@ -0,0 +1,599 @@
+/*
+ * reactor.c - Event-driven proxy core. One thread multiplexes every
+ *     connection over an edge-triggered epoll instance. Sockets are
+ *     non-blocking and each connection is a small state machine that
+ *     runs until it would block, then waits for the next edge on either
+ *     of its sockets.
+ */
+#include <sys/epoll.h>
+#include "reactor.h"
+#include "proxy.h"
+#include "upstream.h"
+
+// Step results returned by the per-state handlers
+#define STEP_AGAIN 1     // State advanced; keep driving
+#define STEP_BLOCKED 0   // Would block; wait for the next edge
+#define STEP_CLOSE -1    // Finished or failed; close the connection
+
+// Per-thread, so several reactors can run side by side (proxy -r)
+static __thread int epfd;              // This thread's epoll instance
+static __thread conn *closed_list;     // Closed this batch; freed once the batch is done
+static __thread notifier wakeups;      // Where other threads wake this thread's parked connections
+
+static void accept_all(int listenfd);
+static void watch(int fd, uint32_t events, void *ptr);
+static void woken(void);
+static void conn_drive(conn *c);
+static void conn_close(conn *c);
+static int read_request(conn *c);
+static int dispatch_request(conn *c, http_request *req);
+static int follow(conn *c);
+static int connect_origin(conn *c);
+static int finish_resolve(conn *c);
+static int retry_origin(conn *c);
+static int start_connect(conn *c);
+static int finish_connect(conn *c);
+static int send_request(conn *c);
+static int relay(conn *c);
+static int finish_relay(conn *c);
+static int write_cached(conn *c);
+
+/* Serve connections accepted on listenfd forever from the calling thread */
+void reactor_run(int listenfd) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    if (fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK) < 0)
+        unix_error("fcntl error");
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        unix_error("epoll_create1 error");
+    watch(listenfd, EPOLLIN | EPOLLET, NULL);  // NULL marks the listening socket
+    notifier_init(&wakeups);
+    watch(wakeups.efd, EPOLLIN | EPOLLET, &wakeups);
+
+    while (1) {
+        int n = epoll_wait(epfd, events, REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_all(listenfd);
+            else if (events[i].data.ptr == &wakeups)
+                woken();
+            else
+                conn_drive(events[i].data.ptr);
+        }
+
+        // A closed connection may still have had events later in the batch
+        while (closed_list) {
+            conn *c = closed_list;
+            closed_list = c->next_closed;
+            Free(c);
+        }
+    }
+}
+
+/* Accept until the backlog is drained (required with edge triggering) */
+static void accept_all(int listenfd) {
+    while (1) {
+        int fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "accept4 error: %s\n", strerror(errno));
+            return;
+        }
+
+        conn *c = Calloc(1, sizeof(conn));
+        c->state = CONN_READ_REQUEST;
+        c->clientfd = fd;
+        c->serverfd = -1;
+        c->wake.data = c;
+        c->wake.notifier = &wakeups;
+        // Adding an fd that is already readable reports it right away
+        watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, c);
+    }
+}
+
+/* Register fd with the epoll instance */
+static void watch(int fd, uint32_t events, void *ptr) {
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = ptr;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        unix_error("epoll_ctl error");
+}
+
+/* Notices were posted: run the connections that were parked on them */
+static void woken(void) {
+    notice *e, *next;
+
+    for (e = notifier_take(&wakeups); e; e = next) {
+        conn *c = e->data;
+        next = e->next;
+        c->waiting = 0;
+        conn_drive(c);
+    }
+}
+
+/* Run c's state machine until it blocks or finishes */
+static void conn_drive(conn *c) {
+    int rc;
+
+    if (c->waiting)
+        return;  // Only its wake notice moves a parked connection on
+
+    do {
+        switch (c->state) {
+        case CONN_READ_REQUEST: rc = read_request(c); break;
+        case CONN_FOLLOWING:    rc = follow(c); break;
+        case CONN_RESOLVING:    rc = finish_resolve(c); break;
+        case CONN_CONNECTING:   rc = finish_connect(c); break;
+        case CONN_SEND_REQUEST: rc = send_request(c); break;
+        case CONN_RELAY:        rc = relay(c); break;
+        case CONN_WRITE_CACHED: rc = write_cached(c); break;
+        default:                return;  // Closed earlier in this batch
+        }
+    } while (rc == STEP_AGAIN);
+
+    if (rc == STEP_CLOSE)
+        conn_close(c);
+}
+
+/* Release everything c holds; the struct itself is freed after the batch */
+static void conn_close(conn *c) {
+    close(c->clientfd);  // Closing also removes the fd from the epoll set
+    if (c->serverfd >= 0)
+        close(c->serverfd);
+    if (c->cached)
+        cache_release(c->cached);
+    end_flight(c, 0);
+    if (c->cache_buf)
+        Free(c->cache_buf);
+    c->state = CONN_CLOSED;
+    c->next_closed = closed_list;
+    closed_list = c;
+}
+
+/* CONN_READ_REQUEST: buffer the request up to the blank line ending its headers */
+static int read_request(conn *c) {
+    http_request req;
+    int rc;
+
+    while (1) {
+        if (c->request_len == sizeof(c->request) - 1)
+            return STEP_CLOSE;  // Headers too large
+
+        ssize_t n = read(c->clientfd, c->request + c->request_len,
+                         sizeof(c->request) - 1 - c->request_len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? STEP_BLOCKED : STEP_CLOSE;
+        }
+        if (n == 0)
+            return STEP_CLOSE;  // Client went away before finishing its request
+
+        c->request_len += n;
+        if ((rc = http_parse_request(&req, c->request, c->request_len)) != HTTP_PARSE_INCOMPLETE)
+            return rc < 0 ? STEP_CLOSE : dispatch_request(c, &req);
+    }
+}
+
+/* Serve a complete request from the cache or start fetching it from the origin */
+static int dispatch_request(conn *c, http_request *req) {
+    switch (prepare_request(c, req)) {
+    case REQUEST_CACHED:
+        c->state = CONN_WRITE_CACHED;
+        return STEP_AGAIN;
+    case REQUEST_ORIGIN:
+        return connect_origin(c);
+    case REQUEST_FOLLOW:
+        c->state = CONN_FOLLOWING;
+        c->cached_off = 0;
+        return STEP_AGAIN;
+    default:
+        return STEP_CLOSE;
+    }
+}
+
+/*
+ * Route the request parsed from c->request. Either takes a reference to
+ * the cached response in c->cached, or builds the upstream request in
+ * c->buf (it is not needed for relaying yet) for c->hostname:c->port.
+ * If another request is already fetching the URI, c follows that fetch
+ * instead of starting its own.
+ */
+int prepare_request(conn *c, http_request *req) {
+    printf("Request headers:\n %.*s %s %.*s\n", (int)req->method.len, req->method.p, req->uri.p,
+           (int)req->version.len, req->version.p);
+
+    /*Only handle GET and HEAD methods*/
+    if (!http_str_eq(req->method, "GET") && !http_str_eq(req->method, "HEAD")) {
+        printf("Proxy does not implement this method\n");
+        return REQUEST_INVALID;
+    }
+
+    // Cache and flights are keyed by the full URI, whichever form the request used
+    if (http_request_key(req, c->uri, sizeof(c->uri)) < 0)
+        return REQUEST_INVALID;
+
+    // Check if the URI response is cached; a stale copy is revalidated as in serve_request
+    http_validators validators;
+    int stale;
+    if ((c->cached = cache_find(c->uri, &stale)) != NULL) {
+        if (!stale) {
+            printf("Serving from cache: %s\n", c->uri);
+            return REQUEST_CACHED;
+        }
+        c->revalidating = !http_request_conditional(req) &&
+                          http_response_validators(c->cached->response, c->cached->local_size, &validators);
+        if (!c->revalidating) {
+            cache_release(c->cached);
+            c->cached = NULL;
+        }
+    }
+
+    if (http_request_origin(req, c->hostname, sizeof(c->hostname), c->port, sizeof(c->port)) < 0)
+        return REQUEST_INVALID;
+
+    // Gather the rewritten request into buf, from which sends can resume part-way
+    struct iovec iov[HTTP_MAX_IOV];
+    int iovcnt = build_http_header(iov, req, c->revalidating ? &validators : NULL);
+    c->header_len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (c->header_len + iov[i].iov_len > sizeof(c->buf))
+            return REQUEST_INVALID;
+        memcpy(c->buf + c->header_len, iov[i].iov_base, iov[i].iov_len);
+        c->header_len += iov[i].iov_len;
+    }
+
+    // A request with credentials gets an answer for its user alone, so it fetches by itself
+    if ((c->credentials = http_request_credentials(req)))
+        return REQUEST_ORIGIN;
+
+    // Concurrent misses on a URI share one fetch; its leader reads straight into the flight
+    c->flight = flight_join(c->uri, &c->leader);
+    if (!c->leader)
+        return REQUEST_FOLLOW;
+    c->cache_buf = c->flight->data;
+    c->cache_cap = MAX_OBJECT_SIZE;
+    return REQUEST_ORIGIN;
+}
+
+/*
+ * Let go of c's flight. If c leads it and has not landed it yet, land
+ * it now, complete if c->cache_buf (the flight's data) holds the whole
+ * response.
+ */
+void end_flight(conn *c, int complete) {
+    flight *f = c->flight;
+
+    if (!f)
+        return;
+    if (c->leader) {
+        if (!f->landed) {
+            if (complete)
+                flight_publish(f, c->total_bytes);
+            flight_land(f, complete);
+        }
+        c->cache_buf = NULL;  // Freed with the flight
+        c->leader = 0;
+    }
+    flight_release(f);
+    c->flight = NULL;
+}
+
+/* CONN_FOLLOWING: relay the flight's data as it is published */
+static int follow(conn *c) {
+    flight *f = c->flight;
+    int landed;
+
+    while (1) {
+        size_t size = flight_poll(f, c->cached_off, &c->wake, &landed);
+        if (c->cached_off == size) {
+            if (!landed) {
+                c->waiting = 1;  // Until the leader publishes more
+                return STEP_BLOCKED;
+            }
+            if (!f->complete && c->cached_off == 0) {
+                end_flight(c, 0);
+                if (refreshed_entry(c)) {
+                    c->state = CONN_WRITE_CACHED;
+                    return STEP_AGAIN;
+                }
+                return connect_origin(c);  // Not a response to share; fetch it ourselves
+            }
+            return STEP_CLOSE;
+        }
+
+        ssize_t n = send(c->clientfd, f->data + c->cached_off, size - c->cached_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? STEP_BLOCKED : STEP_CLOSE;
+        }
+        c->cached_off += n;
+    }
+}
+
+/* Get a connection to the origin: an idle pooled one if possible, else a new one */
+static int connect_origin(conn *c) {
+    c->header_off = 0;
+    if ((c->serverfd = upstream_take(c->hostname, c->port)) >= 0) {
+        c->reused = 1;
+        c->state = CONN_SEND_REQUEST;
+        watch(c->serverfd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, c);
+        return STEP_AGAIN;
+    }
+
+    // Look the origin up off this thread unless the DNS cache already knows it
+    c->reused = 0;
+    c->dns.hostname = c->hostname;
+    c->dns.port = c->port;
+    c->dns.addrs = c->addrs;
+    c->dns.notice = &c->wake;
+    c->state = CONN_RESOLVING;
+    if (!dns_resolve_async(&c->dns)) {
+        c->waiting = 1;
+        return STEP_BLOCKED;
+    }
+    return finish_resolve(c);
+}
+
+/* CONN_RESOLVING: once the lookup is answered, connect to the first address */
+static int finish_resolve(conn *c) {
+    if (c->dns.error) {
+        fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", c->hostname, c->port, gai_strerror(c->dns.error));
+        return STEP_CLOSE;
+    }
+    c->addr_index = 0;
+    return start_connect(c);
+}
+
+/* A pooled connection died before answering; drop it and fetch over another */
+static int retry_origin(conn *c) {
+    close(c->serverfd);
+    c->serverfd = -1;
+    return connect_origin(c);
+}
+
+/* Begin a non-blocking connect to the first address that accepts one */
+static int start_connect(conn *c) {
+    for (; c->addr_index < c->dns.count; c->addr_index++) {
+        dns_addr *a = &c->addrs[c->addr_index];
+        int fd = socket(a->family, a->socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, (SA *)&a->addr, a->addrlen) == 0 || errno == EINPROGRESS) {
+            c->serverfd = fd;
+            c->state = CONN_CONNECTING;
+            watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, c);
+            return STEP_AGAIN;
+        }
+        close(fd);
+    }
+    dns_forget(c->hostname, c->port);  // The origin may have moved; look it up afresh next time
+    printf("Failed to connect to the end server\n");
+    return STEP_CLOSE;
+}
+
+/* CONN_CONNECTING: a repeated connect() reports whether the first one finished */
+static int finish_connect(conn *c) {
+    dns_addr *a = &c->addrs[c->addr_index];
+
+    if (connect(c->serverfd, (SA *)&a->addr, a->addrlen) < 0 && errno != EISCONN) {
+        if (errno == EALREADY || errno == EINPROGRESS || errno == EINTR)
+            return STEP_BLOCKED;
+
+        // This address refused us; try the next one
+        close(c->serverfd);
+        c->serverfd = -1;
+        c->addr_index++;
+        return start_connect(c);
+    }
+
+    c->state = CONN_SEND_REQUEST;
+    return STEP_AGAIN;
+}
+
+/* CONN_SEND_REQUEST: write the rewritten request to the origin */
+static int send_request(conn *c) {
+    while (c->header_off < c->header_len) {
+        ssize_t n = send(c->serverfd, c->buf + c->header_off, c->header_len - c->header_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return STEP_BLOCKED;
+            return c->reused ? retry_origin(c) : STEP_CLOSE;
+        }
+        c->header_off += n;
+    }
+
+    c->buf_len = c->buf_off = c->held = 0;
+    http_response_init(&c->resp, 0, c->credentials);
+    c->state = CONN_RELAY;
+    return STEP_AGAIN;
+}
+
+/* CONN_RELAY: copy the response to the client, only reading more once buf is drained */
+static int relay(conn *c) {
+    while (1) {
+        if (c->buf_off < c->buf_len && !c->client_gone) {
+            ssize_t n = send(c->clientfd, c->buf + c->buf_off, c->buf_len - c->buf_off, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return STEP_BLOCKED;
+                if (!c->leader || c->flight->landed)
+                    return STEP_CLOSE;
+                c->client_gone = 1;  // Finish the fetch for the followers
+                continue;
+            }
+            c->buf_off += n;
+            continue;
+        }
+
+        if (c->server_done)
+            return finish_relay(c);
+
+        ssize_t n = read(c->serverfd, c->buf + c->held, MAXBUF - c->held);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return STEP_BLOCKED;
+        }
+        if (n <= 0) {
+            // A pooled connection the origin closed before answering
+            if (c->reused && c->total_bytes == 0)
+                return retry_origin(c);
+            if (n < 0)
+                return STEP_CLOSE;
+            c->server_eof = c->server_done = 1;
+            continue;
+        }
+
+        // Relay only this response's bytes and stop where it ends
+        size_t used = http_response_feed(&c->resp, c->buf + c->held, n);
+        append_cache(c, c->buf + c->held, used);
+        if (c->client_gone && c->flight->landed)
+            return STEP_CLOSE;  // The followers no longer need it either
+        c->buf_len = c->held + used;
+        c->buf_off = 0;
+        c->server_done = http_response_complete(&c->resp, 0);
+        if (c->revalidating && hold_response(c) && c->held == MAXBUF)
+            return STEP_CLOSE;  // A head too large to hold
+    }
+}
+
+/* The response has been relayed: cache it, and pool the origin connection if it can be reused */
+static int finish_relay(conn *c) {
+    int reusable = c->resp.state == RESP_DONE && c->resp.keep_alive && !c->server_eof;
+    int refreshed = revalidated(c);
+
+    // Cache the response if it is complete, within the limit, and allowed
+    // to be reused; a refreshed one is in the cache already
+    int cacheable = !refreshed && http_response_complete(&c->resp, c->server_eof) && c->resp.fresh_until &&
+                    c->cache_buf && c->total_bytes <= MAX_OBJECT_SIZE;
+    if (cacheable)
+        cache_store(c->uri, c->cache_buf, c->total_bytes, c->resp.fresh_until);
+    end_flight(c, cacheable);  // After the store, so misses from now on find it
+
+    if (reusable) {
+        // Another thread's reactor may take it next, so stop watching it here
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->serverfd, NULL);
+        upstream_give(c->hostname, c->port, c->serverfd);
+        c->serverfd = -1;
+    }
+    if (refreshed) {
+        c->state = CONN_WRITE_CACHED;
+        c->cached_off = 0;
+        return STEP_AGAIN;
+    }
+    return STEP_CLOSE;
+}
+
+/* CONN_WRITE_CACHED: send straight from the referenced cache block */
+static int write_cached(conn *c) {
+    struct iovec iov[2];
+    struct msghdr msg = {.msg_iov = iov};
+
+    while (c->cached_off < c->cached->size) {
+        msg.msg_iovlen = cache_iov(c->cached, c->cached_off, iov);
+        ssize_t n = sendmsg(c->clientfd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? STEP_BLOCKED : STEP_CLOSE;
+        }
+        c->cached_off += n;
+    }
+    return STEP_CLOSE;
+}
+
+/*
+ * While c revalidates a stale copy, keep the origin's response head in
+ * buf instead of relaying it. Returns 1 while the head is still arriving,
+ * with held set to the bytes kept. Once it is in, a 304 is dropped so the
+ * updated stored response can be sent instead, and any other response is
+ * relayed in place of the copy, starting with the held bytes.
+ */
+int hold_response(conn *c) {
+    if (c->resp.state == RESP_STATUS || c->resp.state == RESP_HEADERS) {
+        c->held = c->buf_len;
+        c->buf_len = 0;
+        return 1;
+    }
+    c->held = 0;
+    if (c->resp.status == 304) {
+        c->buf_len = 0;
+        return 0;
+    }
+    c->revalidating = 0;
+    cache_release(c->cached);
+    c->cached = NULL;
+    return 0;
+}
+
+/*
+ * If the origin answered c's revalidation with a 304, point c->cached at
+ * the entry that now replaces the stale copy: the stored response with
+ * the 304's headers merged in, sharing the copy's body. If that cannot
+ * be built, the copy goes out as it was. Either way, return 1.
+ */
+int revalidated(conn *c) {
+    cache_block *block;
+
+    if (!c->revalidating || c->resp.state != RESP_DONE || c->resp.status != 304)
+        return 0;
+    if ((block = revalidate_response(c->cached, c->cache_buf, c->total_bytes, &c->resp)) != NULL) {
+        cache_release(c->cached);
+        c->cached = block;
+    }
+    return 1;
+}
+
+/*
+ * A follower whose flight landed without data: if the leader refreshed
+ * a stale copy, the result is in the cache. Point c->cached at it and
+ * return 1; return 0 if there is none.
+ */
+int refreshed_entry(conn *c) {
+    cache_block *block;
+
+    if ((block = cache_find(c->uri, NULL)) == NULL)
+        return 0;
+    if (c->cached)
+        cache_release(c->cached);
+    c->cached = block;
+    c->revalidating = 0;
+    printf("Serving from cache: %s\n", c->uri);
+    return 1;
+}
+
+/* Keep a copy of the n bytes of data just read while the response still fits in an object, sharing it with any followers */
+void append_cache(conn *c, const char *data, size_t n) {
+    if (c->total_bytes + n <= MAX_OBJECT_SIZE) {
+        if (c->total_bytes + n > c->cache_cap) {
+            // Grow geometrically so small responses never cost a full object
+            size_t cap = c->cache_cap ? c->cache_cap : MAXBUF;
+            while (cap < c->total_bytes + n)
+                cap *= 2;
+            if (cap > MAX_OBJECT_SIZE)
+                cap = MAX_OBJECT_SIZE;
+            c->cache_buf = Realloc(c->cache_buf, cap);
+            c->cache_cap = cap;
+        }
+        memcpy(c->cache_buf + c->total_bytes, data, n);
+    }
+    c->total_bytes += n;
+    if (c->leader)
+        share_response(c->flight, &c->resp, c->total_bytes);
+}
@@ -0,0 +1,77 @@
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include "csapp.h"
+#include "cache.h"
+#include "http.h"
+#include "dns.h"
+#include "flight.h"
+#include "notify.h"
+
+#define REACTOR_MAX_EVENTS 256  // Events handled per epoll_wait call
+
+// Outcomes of prepare_request
+#define REQUEST_INVALID -1  // Malformed or unsupported; close the connection
+#define REQUEST_CACHED 0    // Serve c->cached
+#define REQUEST_ORIGIN 1    // Send c->buf to the origin
+#define REQUEST_FOLLOW 2    // Another request is fetching it; relay c->flight as it fills
+
+// Connection states, in the order a request moves through them
+typedef enum {
+    CONN_READ_REQUEST,   // Reading the request line and headers from the client
+    CONN_FOLLOWING,      // Relaying another request's fetch of the same URI as it arrives
+    CONN_RESOLVING,      // Waiting for the resolver threads to look up the origin
+    CONN_CONNECTING,     // Non-blocking connect to the origin in progress
+    CONN_SEND_REQUEST,   // Writing the rewritten request to the origin
+    CONN_RELAY,          // Copying the origin's response to the client
+    CONN_WRITE_CACHED,   // Writing a cache hit to the client
+    CONN_CLOSED          // Finished; freed at the end of the event batch
+} conn_state;
+
+// Per-connection state machine; both sockets' epoll events (or io_uring completions) point here
+typedef struct conn {
+    conn_state state;
+    int clientfd;                 // Client socket
+    int serverfd;                 // Origin socket, or -1
+    int reused;                   // serverfd came from the keep-alive pool
+    notice wake;                  // Posted to this loop when what c waits on is ready
+    int waiting;                  // Parked until wake is posted; socket events are ignored
+    char request[MAXLINE];        // Request line and headers as received
+    size_t request_len;
+    char uri[MAXLINE];            // Cache key: the full URI, even for an origin-form request
+    char hostname[NI_MAXHOST];    // Origin, also the key for its connection pool
+    char port[NI_MAXSERV];
+    size_t header_len, header_off;  // Request rewritten for the origin, kept in buf until sent
+    flight *flight;               // Fetch of uri that c leads or follows
+    int leader;                   // c fetches flight, reading into its data
+    int client_gone;              // The leader's client hung up; the fetch goes on for the followers
+    int credentials;              // The request carries Authorization or Cookie: fetched alone, without a flight
+    dns_query dns;                // Lookup of hostname:port, answering into addrs
+    dns_addr addrs[DNS_MAX_ADDRS];  // Origin addresses, dns.count of them
+    int addr_index;               // Address currently being connected to
+    cache_block *cached;          // Cache hit being written, or stale copy being revalidated, with a reference held
+    size_t cached_off;
+    struct msghdr msg;            // io_uring: sendmsg of cached from cached_off, through iov
+    struct iovec iov[2];
+    int revalidating;             // The origin was sent cached's validators; its response head is held until it answers
+    char buf[MAXBUF];             // Origin bytes not yet written to the client
+    size_t buf_len, buf_off;
+    size_t held;                  // Bytes of the response head kept at the start of buf while revalidating
+    http_response resp;           // Delimits the origin's response
+    int server_done;              // Response fully read from the origin
+    int server_eof;               // Origin has closed its side
+    char *cache_buf;              // Copy of the response for the cache, grown on demand
+    size_t cache_cap, total_bytes;
+    struct conn *next_closed;     // Link in the batch's list of closed connections
+} conn;
+
+/* Function Prototypes */
+void reactor_run(int listenfd);
+int prepare_request(conn *c, http_request *req);  // Shared with the io_uring backend (uring.c)
+void end_flight(conn *c, int complete);
+void append_cache(conn *c, const char *data, size_t n);
+int hold_response(conn *c);
+int revalidated(conn *c);
+int refreshed_entry(conn *c);
+
+#endif /* __REACTOR_H__ */
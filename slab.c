@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include "slab.h"
+
+static slab_class classes[SLAB_MAX_CLASSES];
+static int class_count;
+static size_t held_bytes;  // Pages and lone chunks taken from malloc
+static size_t used_bytes;  // Chunks handed out
+
+static void add_class(size_t chunk_size);
+static slab_class *class_for(size_t size);
+static slab_page *new_page(slab_class *c);
+static void link_page(slab_class *c, slab_page *page);
+static void unlink_page(slab_class *c, slab_page *page);
+
+/* Build the size classes, from SLAB_MIN_CHUNK up to exactly max_chunk */
+void slab_init(size_t max_chunk) {
+    size_t size = SLAB_MIN_CHUNK;
+
+    class_count = 0;
+    while (size < max_chunk && class_count < SLAB_MAX_CLASSES - 1) {
+        add_class(size);
+
+        // Grow geometrically, keeping chunks 8-byte aligned
+        size_t next = (size * SLAB_GROWTH_NUM / SLAB_GROWTH_DEN + 7) & ~(size_t)7;
+        size = next > size ? next : size + 8;
+    }
+    add_class(max_chunk);
+}
+
+/* Return the number of bytes slab_alloc really hands out for a request of size bytes */
+size_t slab_chunk_size(size_t size) {
+    slab_class *c = class_for(size);
+    return c ? c->chunk_size : 0;
+}
+
+/* Allocate a chunk of at least size bytes from the smallest fitting class */
+void *slab_alloc(size_t size) {
+    slab_class *c = class_for(size);
+    slab_page *page;
+    void *chunk;
+
+    if (!c)
+        return NULL;  // Larger than the largest class
+
+    if (!c->per_page) {
+        chunk = Malloc(c->chunk_size);
+        __atomic_add_fetch(&held_bytes, c->chunk_size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&used_bytes, c->chunk_size, __ATOMIC_RELAXED);
+        return chunk;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if (!(page = c->partial))
+        page = new_page(c);
+    chunk = page->free_list;
+    page->free_list = *(void **)chunk;
+    page->used++;
+    if (!page->free_list)
+        unlink_page(c, page);  // Full; it returns on its next free chunk
+    pthread_mutex_unlock(&c->lock);
+    __atomic_add_fetch(&used_bytes, c->chunk_size, __ATOMIC_RELAXED);
+    return chunk;
+}
+
+/*
+ * Return a chunk obtained from slab_alloc(size) to its class. A page
+ * left with no chunks in use goes back to malloc, so the memory held
+ * follows the memory used instead of keeping the peak of every class.
+ */
+void slab_free(void *chunk, size_t size) {
+    slab_class *c = class_for(size);
+    slab_page *page;
+
+    __atomic_sub_fetch(&used_bytes, c->chunk_size, __ATOMIC_RELAXED);
+    if (!c->per_page) {
+        __atomic_sub_fetch(&held_bytes, c->chunk_size, __ATOMIC_RELAXED);
+        Free(chunk);
+        return;
+    }
+
+    page = (slab_page *)((uintptr_t)chunk & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+    pthread_mutex_lock(&c->lock);
+    if (!page->free_list)
+        link_page(c, page);  // Was full
+    *(void **)chunk = page->free_list;
+    page->free_list = chunk;
+    if (--page->used == 0) {
+        unlink_page(c, page);
+        Free(page);
+        __atomic_sub_fetch(&held_bytes, SLAB_PAGE_SIZE, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * Report the bytes taken from malloc and the bytes in chunks handed out;
+ * the difference is free chunks in partly used pages. Taken while other
+ * threads allocate, the two may be a chunk apart either way.
+ */
+void slab_stats(size_t *held, size_t *used) {
+    *held = __atomic_load_n(&held_bytes, __ATOMIC_RELAXED);
+    *used = __atomic_load_n(&used_bytes, __ATOMIC_RELAXED);
+}
+
+/* Append a class of chunk_size chunks; pages hold them after their header */
+static void add_class(size_t chunk_size) {
+    slab_class *c = &classes[class_count++];
+
+    c->chunk_size = chunk_size;
+    c->per_page = (SLAB_PAGE_SIZE - sizeof(slab_page)) / chunk_size;
+    if (c->per_page < 2)
+        c->per_page = 0;
+    c->partial = NULL;
+    pthread_mutex_init(&c->lock, NULL);
+}
+
+/* Binary search for the smallest class whose chunks hold size bytes */
+static slab_class *class_for(size_t size) {
+    int lo = 0, hi = class_count - 1;
+
+    if (size > classes[hi].chunk_size)
+        return NULL;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (classes[mid].chunk_size >= size)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return &classes[lo];
+}
+
+/* Carve a new page into c's chunks and make it c's page with room; caller holds c->lock */
+static slab_page *new_page(slab_class *c) {
+    slab_page *page = NULL;  // unix_error exits, but the compiler cannot tell
+    char *chunks;
+    int rc;
+
+    // Aligned to its size, so a chunk finds its page by masking its address
+    if ((rc = posix_memalign((void **)&page, SLAB_PAGE_SIZE, SLAB_PAGE_SIZE)) != 0) {
+        errno = rc;
+        unix_error("posix_memalign error");
+    }
+    __atomic_add_fetch(&held_bytes, SLAB_PAGE_SIZE, __ATOMIC_RELAXED);
+
+    page->free_list = NULL;
+    page->used = 0;
+    chunks = (char *)(page + 1);
+    for (size_t i = c->per_page; i-- > 0;) {
+        *(void **)(chunks + i * c->chunk_size) = page->free_list;
+        page->free_list = chunks + i * c->chunk_size;
+    }
+    link_page(c, page);
+    return page;
+}
+
+/* Put page at the head of c's pages with room; caller holds c->lock */
+static void link_page(slab_class *c, slab_page *page) {
+    page->prev = NULL;
+    page->next = c->partial;
+    if (c->partial)
+        c->partial->prev = page;
+    c->partial = page;
+}
+
+/* Take page off c's pages with room; caller holds c->lock */
+static void unlink_page(slab_class *c, slab_page *page) {
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        c->partial = page->next;
+    if (page->next)
+        page->next->prev = page->prev;
+}
@@ -0,0 +1,35 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include "csapp.h"
+
+// Slab allocator constants
+#define SLAB_MIN_CHUNK 64       // Smallest chunk size (in bytes)
+#define SLAB_GROWTH_NUM 17      // Each size class is 17/16 of the previous one,
+#define SLAB_GROWTH_DEN 16      // so a chunk wastes at most ~6% of its size
+#define SLAB_PAGE_SIZE 16384    // Small chunks are carved out of pages this big, aligned to their size
+#define SLAB_MAX_CLASSES 256    // Upper bound on the number of size classes
+
+// Header at the start of every page of small chunks
+typedef struct slab_page {
+    struct slab_page *prev, *next;  // Neighbours among its class's pages with free chunks
+    void *free_list;                // Free chunks in this page, linked through their first word
+    size_t used;                    // Chunks handed out; the page goes back to malloc at 0
+} slab_page;
+
+// Size class: equally sized chunks, carved from shared pages if they are small
+typedef struct {
+    size_t chunk_size;      // Size of every chunk in this class
+    size_t per_page;        // Chunks per page; 0 if two do not fit, so each is malloc'ed alone
+    slab_page *partial;     // Pages with a free chunk
+    pthread_mutex_t lock;   // Guards partial and the pages on it
+} slab_class;
+
+/* Function Prototypes */
+void slab_init(size_t max_chunk);
+size_t slab_chunk_size(size_t size);
+void *slab_alloc(size_t size);
+void slab_free(void *chunk, size_t size);
+void slab_stats(size_t *held, size_t *used);
+
+#endif /* __SLAB_H__ */
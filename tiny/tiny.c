@@ -9,9 +9,9 @@
 #include "csapp.h"
 
 void doit(int fd);
-void read_requesthdrs(rio_t *rp);
+void read_requesthdrs(rio_t *rp, char *if_none_match, char *if_modified_since);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize, char *method);
+void serve_static(int fd, char *filename, struct stat *sbuf, char *method, char *if_none_match, char *if_modified_since);
 void get_filetype(char *filename, char *filetype);
 void serve_dynamic(int fd, char *filename, char *cgiargs, char *method);
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
@@ -50,6 +50,8 @@ void doit(int fd)
     //request line 정보 저장 buffer
     char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
     char filename[MAXLINE], cgiargs[MAXLINE];
+    //conditional request header 값 저장 buffer (없으면 빈 문자열)
+    char if_none_match[MAXLINE], if_modified_since[MAXLINE];
     //client와 connection handling 위한 I/O structure
     rio_t rio;
 
@@ -65,7 +67,7 @@ void doit(int fd)
         clienterror(fd, method, "501", "Not Implemented", "Tiny does not implement this method");
         return;
     }                                                    
-    read_requesthdrs(&rio);//HTTP header read
+    read_requesthdrs(&rio, if_none_match, if_modified_since);//HTTP header read
 
     /* Parse URI from GET request */
     is_static = parse_uri(uri, filename, cgiargs);//URI를 바탕으로 static or dynamic content request인지 판단
@@ -81,7 +83,7 @@ void doit(int fd)
 			"Tiny couldn't read the file"); //check 통과 못할 시 error
 	    return;
 	}
-	serve_static(fd, filename, sbuf.st_size, method);//check 통과 시 serve_static함수로 client에 file 제공
+	serve_static(fd, filename, &sbuf, method, if_none_match, if_modified_since);//check 통과 시 serve_static함수로 client에 file 제공
     }
     else { /* Serve dynamic content */
 	if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) { //dynamic content가 executable하고 regular 한지 check
@@ -116,13 +118,18 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
     //HTTP response body
     Rio_writen(fd, body, strlen(body));
 }
-/*request header 읽어주는 함수*/
-void read_requesthdrs(rio_t *rp) 
+/*request header 읽어주는 함수, If-None-Match와 If-Modified-Since 값은 따로 저장*/
+void read_requesthdrs(rio_t *rp, char *if_none_match, char *if_modified_since) 
 {
     char buf[MAXLINE]; 
+    *if_none_match = *if_modified_since = '\0'; //header가 없으면 빈 문자열
     Rio_readlineb(rp, buf, MAXLINE); //각 라인을 읽어서 변수로 저장
     printf("%s", buf);               
     while(strcmp(buf, "\r\n")) {     //빈 라인이 나올때까지 while loop
+	if (!strncasecmp(buf, "If-None-Match:", 14))           //ETag 비교용 header
+	    sscanf(buf + 14, " %[^\r\n]", if_none_match);
+	else if (!strncasecmp(buf, "If-Modified-Since:", 18))  //Last-Modified 비교용 header
+	    sscanf(buf + 18, " %[^\r\n]", if_modified_since);
 	Rio_readlineb(rp, buf, MAXLINE); //빈 라인 전까지 라인을 read해서 buf에 저장
 	printf("%s", buf);               
     }
@@ -182,16 +189,42 @@ void serve_static(int fd, char *filename, int filesize)
 }
 */
 
-/*serve_static malloc version*/
-void serve_static(int fd, char *filename, int filesize, char *method) 
+/*serve_static malloc version, ETag/Last-Modified validator와 304 Not Modified 지원*/
+void serve_static(int fd, char *filename, struct stat *sbuf, char *method, char *if_none_match, char *if_modified_since) 
 {
-    int srcfd;
+    int srcfd, filesize = sbuf->st_size;
     char *srcp, filetype[MAXLINE], buf[MAXBUF];
+    char etag[64], last_modified[64], date[64]; //validator와 HTTP date string
+    time_t now = time(NULL);
+    struct tm tm;
+
+    //validator: ETag는 file size와 수정 시각으로 만들고, Last-Modified는 HTTP date 형식
+    sprintf(etag, "\"%lx-%lx\"", (long)sbuf->st_size, (long)sbuf->st_mtime);
+    strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&sbuf->st_mtime, &tm));
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&now, &tm));
+
+    //If-None-Match가 있으면 그것만 보고, 없으면 If-Modified-Since를 Last-Modified와 비교
+    if (*if_none_match ? (!strcmp(if_none_match, etag) || !strcmp(if_none_match, "*"))
+                       : !strcmp(if_modified_since, last_modified)) {
+        sprintf(buf, "HTTP/1.0 304 Not Modified\r\n"); //바뀌지 않았으면 body 없이 304만 보낸다
+        sprintf(buf + strlen(buf), "Server: Tiny Web Server\r\n");
+        sprintf(buf + strlen(buf), "Connection: close\r\n");
+        sprintf(buf + strlen(buf), "Date: %s\r\n", date);
+        sprintf(buf + strlen(buf), "ETag: %s\r\n", etag);
+        sprintf(buf + strlen(buf), "Last-Modified: %s\r\n\r\n", last_modified);
+        Rio_writen(fd, buf, strlen(buf));
+        printf("Response headers:\n");
+        printf("%s", buf);
+        return;
+    }
 
     get_filetype(filename, filetype);       //file의 MIME type filetype buffer에 저장(.html, .jpg, .png 등)
     sprintf(buf, "HTTP/1.0 200 OK\r\n");    //HTTP response header를 만들고
     sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);
     sprintf(buf, "%sConnection: close\r\n", buf);
+    sprintf(buf + strlen(buf), "Date: %s\r\n", date);
+    sprintf(buf + strlen(buf), "ETag: %s\r\n", etag);
+    sprintf(buf + strlen(buf), "Last-Modified: %s\r\n", last_modified);
     sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
     sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype); 
     Rio_writen(fd, buf, strlen(buf));       //client에 HTTP response header를 보낸다
@@ -0,0 +1,118 @@
+/*
+ * upstream.c - Pool of idle keep-alive connections to origin servers,
+ *     keyed by (hostname, port). A reaper thread closes connections that
+ *     have been idle for longer than UPSTREAM_IDLE_TIMEOUT.
+ */
+#include "upstream.h"
+#include "cache.h"
+
+static upstream_origin *buckets[UPSTREAM_BUCKETS];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;  // Guards buckets and everything reachable from them
+
+static upstream_origin *find_origin(char *hostname, char *port, int create);
+static void *reaper(void *vargp);
+
+/* Start the reaper thread */
+void upstream_init(void) {
+    pthread_t tid;
+    Pthread_create(&tid, NULL, reaper, NULL);
+}
+
+/*
+ * Return an idle connection to hostname:port, or -1 if there is none.
+ * Connections the origin has closed (or that have unread data, which a
+ * finished response never leaves) are discarded on the way.
+ */
+int upstream_take(char *hostname, char *port) {
+    upstream_origin *origin;
+    upstream_conn *conn;
+    char c;
+    int fd = -1;
+
+    pthread_mutex_lock(&pool_lock);
+    if ((origin = find_origin(hostname, port, 0)) != NULL) {
+        while ((conn = origin->idle) != NULL) {
+            origin->idle = conn->next;
+            origin->idle_count--;
+            fd = conn->fd;
+            Free(conn);
+            if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;  // Still open and quiet
+            close(fd);
+            fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return fd;
+}
+
+/* Return a connection whose last response was fully read to the pool */
+void upstream_give(char *hostname, char *port, int fd) {
+    upstream_origin *origin;
+    upstream_conn *conn;
+
+    pthread_mutex_lock(&pool_lock);
+    origin = find_origin(hostname, port, 1);
+    if (origin->idle_count >= UPSTREAM_MAX_IDLE) {
+        pthread_mutex_unlock(&pool_lock);
+        close(fd);
+        return;
+    }
+    conn = Malloc(sizeof(upstream_conn));
+    conn->fd = fd;
+    conn->idle_since = time(NULL);
+    conn->next = origin->idle;
+    origin->idle = conn;
+    origin->idle_count++;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* Look up an origin; caller holds pool_lock */
+static upstream_origin *find_origin(char *hostname, char *port, int create) {
+    char key[NI_MAXHOST + NI_MAXSERV + 1];
+    upstream_origin **bucket, *origin;
+
+    snprintf(key, sizeof(key), "%s:%s", hostname, port);
+    bucket = &buckets[cache_hash(key) & (UPSTREAM_BUCKETS - 1)];
+    for (origin = *bucket; origin; origin = origin->next)
+        if (!strcmp(origin->hostname, hostname) && !strcmp(origin->port, port))
+            return origin;
+    if (!create)
+        return NULL;
+
+    origin = Calloc(1, sizeof(upstream_origin));
+    snprintf(origin->hostname, sizeof(origin->hostname), "%s", hostname);
+    snprintf(origin->port, sizeof(origin->port), "%s", port);
+    origin->next = *bucket;
+    *bucket = origin;
+    return origin;
+}
+
+/* Reaper thread routine: periodically close connections idle for too long */
+static void *reaper(void *vargp) {
+    Pthread_detach(pthread_self());
+    while (1) {
+        Sleep(UPSTREAM_REAP_INTERVAL);
+        time_t now = time(NULL);
+
+        pthread_mutex_lock(&pool_lock);
+        for (int i = 0; i < UPSTREAM_BUCKETS; i++) {
+            for (upstream_origin *origin = buckets[i]; origin; origin = origin->next) {
+                // Idle lists are most recent first, so everything after the
+                // first expired connection has expired too
+                upstream_conn **link = &origin->idle;
+                while (*link && now - (*link)->idle_since < UPSTREAM_IDLE_TIMEOUT)
+                    link = &(*link)->next;
+                while (*link) {
+                    upstream_conn *conn = *link;
+                    *link = conn->next;
+                    close(conn->fd);
+                    Free(conn);
+                    origin->idle_count--;
+                }
+            }
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    return NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+#include "csapp.h"
+
+#define UPSTREAM_BUCKETS 256        // Hash buckets of origins (power of two)
+#define UPSTREAM_MAX_IDLE 8         // Idle connections kept per origin
+#define UPSTREAM_IDLE_TIMEOUT 30    // Seconds an idle connection may sit in the pool
+#define UPSTREAM_REAP_INTERVAL 1    // Seconds between sweeps for expired connections
+
+// Idle keep-alive connection to an origin
+typedef struct upstream_conn {
+    int fd;
+    time_t idle_since;            // When it was returned to the pool
+    struct upstream_conn *next;   // Next idle connection to the same origin, most recent first
+} upstream_conn;
+
+// Origin server and its idle connections
+typedef struct upstream_origin {
+    char hostname[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    upstream_conn *idle;          // Most recently used first
+    int idle_count;
+    struct upstream_origin *next; // Next origin in the same bucket
+} upstream_origin;
+
+/* Function Prototypes */
+void upstream_init(void);
+int upstream_take(char *hostname, char *port);
+void upstream_give(char *hostname, char *port, int fd);
+
+#endif /* __UPSTREAM_H__ */
@@ -0,0 +1,613 @@
+/*
+ * uring.c - io_uring proxy core (proxy -u). Runs the same per-connection
+ *     state machine as the epoll reactor, but completion-driven: every
+ *     accept, read, write and connect is queued on a ring and the whole
+ *     batch goes to the kernel in one io_uring_enter call, which also
+ *     waits for the next completions. Client sockets are accepted by a
+ *     single multishot accept straight into fixed file slots, and each
+ *     slot's relay buffer is registered with the ring, so the hot path
+ *     neither looks up file descriptors nor pins pages per request.
+ *     liburing is not required; the ring is driven through the raw
+ *     system calls.
+ */
+#include <sys/syscall.h>
+#include "uring.h"
+#include "proxy.h"
+#include "upstream.h"
+
+#define OP_BITS 8  // user_data = slot << OP_BITS | op
+
+static int uring_setup(uring *ring, int listenfd);
+static int uring_supported(int fd);
+static int accept_fatal(int res);
+static void uring_enter(uring *ring, unsigned wait_nr);
+static struct io_uring_sqe *get_sqe(uring *ring);
+static void arm_accept(uring *ring);
+static void arm_wake(uring *ring);
+static void submit_op(uring *ring, conn *c, uring_op op);
+static void complete(uring *ring, __u64 user_data, int res, unsigned flags);
+static void accepted(uring *ring, int slot);
+static void conn_complete(uring *ring, conn *c, uring_op op, int res);
+static void conn_close(uring *ring, conn *c);
+static void dispatch_request(uring *ring, conn *c, http_request *req);
+static void connect_origin(uring *ring, conn *c);
+static void woken(uring *ring);
+static void follow(uring *ring, conn *c);
+static void finish_resolve(uring *ring, conn *c);
+static void retry_origin(uring *ring, conn *c);
+static void start_connect(uring *ring, conn *c);
+static void finish_relay(uring *ring, conn *c);
+
+/* Serve connections accepted on listenfd forever from the calling thread */
+void uring_run(int listenfd) {
+    uring ring;
+
+    if (uring_setup(&ring, listenfd) < 0) {
+        fprintf(stderr, "io_uring: kernel lacks multishot accept into fixed files (need 5.19 or later); "
+                        "using the epoll reactor instead\n");
+        reactor_run(listenfd);  // Never returns
+    }
+    arm_accept(&ring);
+    arm_wake(&ring);
+
+    while (1) {
+        // Submit everything queued since the last pass and wait for a completion
+        uring_enter(&ring, 1);
+
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            __u64 user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+
+            // Hand the entry back before acting on it; handlers may queue more work
+            __atomic_store_n(ring.cq_head, ++head, __ATOMIC_RELEASE);
+            complete(&ring, user_data, res, flags);
+        }
+    }
+}
+
+/*
+ * Create the ring, map its queues and register the fixed file and buffer
+ * tables; returns -1 if the kernel lacks an operation the ring relies on
+ */
+static int uring_setup(uring *ring, int listenfd) {
+    struct io_uring_params p;
+    struct iovec *iov;
+    int *fds;
+    char *sq;
+
+    memset(&p, 0, sizeof(p));
+    if ((ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+        unix_error("io_uring_setup error");
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) ||
+        !uring_supported(ring->fd)) {
+        close(ring->fd);
+        return -1;
+    }
+
+    // One mapping covers both rings; the submission entries are separate
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    sq = Mmap(NULL, sq_len > cq_len ? sq_len : cq_len, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(sq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(sq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(sq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(sq + p.cq_off.cqes);
+    ring->sqes = Mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    ring->sq_entries = p.sq_entries;
+    ring->pending = 0;
+    ring->accepting = 0;
+    ring->accept_failed = 0;
+    ring->listenfd = listenfd;
+    notifier_init(&ring->wakeups);
+    ring->conns = Calloc(URING_MAX_CONNS, sizeof(conn));
+
+    // An empty fixed file table; multishot accept fills free slots itself
+    fds = Malloc(URING_MAX_CONNS * sizeof(int));
+    for (int i = 0; i < URING_MAX_CONNS; i++)
+        fds[i] = -1;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds, URING_MAX_CONNS) < 0)
+        unix_error("io_uring_register files error");
+    Free(fds);
+
+    // Slot i relays through buffer i; registration fails if the pages cannot be locked
+    iov = Malloc(URING_MAX_CONNS * sizeof(struct iovec));
+    for (int i = 0; i < URING_MAX_CONNS; i++) {
+        iov[i].iov_base = ring->conns[i].buf;
+        iov[i].iov_len = MAXBUF;
+    }
+    ring->fixed_buffers =
+        syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, URING_MAX_CONNS) == 0;
+    if (!ring->fixed_buffers)
+        fprintf(stderr, "io_uring: cannot register buffers (%s); relaying without them\n", strerror(errno));
+    Free(iov);
+
+    for (int i = 0; i < URING_MAX_CONNS; i++)
+        ring->conns[i].state = CONN_CLOSED;
+    return 0;
+}
+
+/*
+ * Does the kernel behind ring fd support every opcode the ring submits?
+ * Multishot accept and IORING_FILE_INDEX_ALLOC have no probe of their
+ * own; they came in 5.19 together with IORING_OP_SOCKET, which stands in
+ * for them.
+ */
+static int uring_supported(int fd) {
+    static const int needed[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SENDMSG, IORING_OP_CONNECT,
+        IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_CLOSE,
+        IORING_OP_SOCKET,
+    };
+    size_t len = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = Calloc(1, len);
+    int ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0;
+
+    for (size_t i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); i++)
+        ok = needed[i] < probe->ops_len && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    Free(probe);
+    return ok;
+}
+
+/* Pass every queued submission to the kernel, waiting for wait_nr completions */
+static void uring_enter(uring *ring, unsigned wait_nr) {
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->pending, __ATOMIC_RELEASE);
+    ring->pending = 0;
+
+    unsigned to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+                wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        unix_error("io_uring_enter error");
+}
+
+/* Claim a zeroed submission entry, flushing the queue to the kernel if it is full */
+static struct io_uring_sqe *get_sqe(uring *ring) {
+    unsigned tail = *ring->sq_tail + ring->pending;
+
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        uring_enter(ring, 0);
+        tail = *ring->sq_tail;
+    }
+    unsigned index = tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    ring->pending++;
+    memset(&ring->sqes[index], 0, sizeof(struct io_uring_sqe));
+    return &ring->sqes[index];
+}
+
+/* Accept client connections into free fixed file slots until told otherwise */
+static void arm_accept(uring *ring) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = ring->listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->file_index = IORING_FILE_INDEX_ALLOC;
+    sqe->user_data = OP_ACCEPT;
+    ring->accepting = 1;
+}
+
+/* Wait for another thread to wake one of this ring's parked connections */
+static void arm_wake(uring *ring) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = ring->wakeups.efd;
+    sqe->addr = (unsigned long)&ring->wake_count;
+    sqe->len = sizeof(ring->wake_count);
+    sqe->user_data = OP_WAKE;
+}
+
+/* Queue c's next operation; its arguments come from c's current state */
+static void submit_op(uring *ring, conn *c, uring_op op) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    int slot = c - ring->conns;
+
+    sqe->user_data = (__u64)slot << OP_BITS | op;
+    switch (op) {
+    case OP_RECV_REQUEST:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = slot;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = (unsigned long)(c->request + c->request_len);
+        sqe->len = sizeof(c->request) - 1 - c->request_len;
+        break;
+    case OP_CONNECT:
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->fd = c->serverfd;
+        sqe->addr = (unsigned long)&c->addrs[c->addr_index].addr;
+        sqe->off = c->addrs[c->addr_index].addrlen;
+        break;
+    case OP_SEND_REQUEST:
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = c->serverfd;
+        sqe->addr = (unsigned long)(c->buf + c->header_off);
+        sqe->len = c->header_len - c->header_off;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        break;
+    case OP_READ_ORIGIN:
+        sqe->opcode = ring->fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = c->serverfd;
+        sqe->addr = (unsigned long)(c->buf + c->held);
+        sqe->len = MAXBUF - c->held;
+        sqe->buf_index = slot;
+        break;
+    case OP_WRITE_CLIENT:
+        sqe->opcode = ring->fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = slot;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = (unsigned long)(c->buf + c->buf_off);
+        sqe->len = c->buf_len - c->buf_off;
+        sqe->buf_index = slot;
+        break;
+    case OP_SEND_CACHED:
+        // A refreshed entry's head and body lie apart
+        c->msg.msg_iov = c->iov;
+        c->msg.msg_iovlen = cache_iov(c->cached, c->cached_off, c->iov);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = slot;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = (unsigned long)&c->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        break;
+    case OP_SEND_FLIGHT:
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = slot;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = (unsigned long)(c->flight->data + c->cached_off);
+        sqe->len = c->buf_len - c->cached_off;  // buf_len holds the bytes published
+        sqe->msg_flags = MSG_NOSIGNAL;
+        break;
+    case OP_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = slot + 1;  // 1-based; 0 would mean a plain fd
+        break;
+    default:
+        break;
+    }
+}
+
+/* Route one completion to the accept handler or its connection */
+static void complete(uring *ring, __u64 user_data, int res, unsigned flags) {
+    uring_op op = user_data & ((1 << OP_BITS) - 1);
+    conn *c = &ring->conns[user_data >> OP_BITS];
+
+    if (op == OP_ACCEPT) {
+        if (res >= 0)
+            accepted(ring, res);
+        else if (res != -ENFILE)
+            fprintf(stderr, "accept error: %s\n", strerror(-res));
+        if (!(flags & IORING_CQE_F_MORE)) {
+            // The multishot accept ended; with every slot taken, wait for a close
+            ring->accepting = 0;
+            if (accept_fatal(res)) {
+                ring->accept_failed = 1;
+                fprintf(stderr, "io_uring: accept cannot be rearmed; this listener stops accepting\n");
+            } else if (res != -ENFILE) {
+                arm_accept(ring);
+            }
+        }
+        return;
+    }
+    if (op == OP_WAKE) {
+        // The eventfd is non-blocking, so the read may also end with -EAGAIN
+        woken(ring);
+        arm_wake(ring);
+        return;
+    }
+    if (op == OP_CLOSE) {
+        c->state = CONN_CLOSED;  // The slot may be handed out again
+        if (!ring->accepting && !ring->accept_failed)
+            arm_accept(ring);
+        return;
+    }
+    conn_complete(ring, c, op, res);
+}
+
+/* Would rearming an accept that ended with res fail the same way every time? */
+static int accept_fatal(int res) {
+    return res == -EINVAL || res == -EBADF || res == -EOPNOTSUPP || res == -ENOTSOCK;
+}
+
+/* A client connection landed in fixed file slot; start reading its request */
+static void accepted(uring *ring, int slot) {
+    conn *c = &ring->conns[slot];
+
+    memset(c, 0, sizeof(conn));
+    c->state = CONN_READ_REQUEST;
+    c->clientfd = slot;
+    c->serverfd = -1;
+    c->wake.data = c;
+    c->wake.notifier = &ring->wakeups;
+    submit_op(ring, c, OP_RECV_REQUEST);
+}
+
+/* Advance c's state machine with the result of its one outstanding operation */
+static void conn_complete(uring *ring, conn *c, uring_op op, int res) {
+    http_request req;
+    size_t used;
+    int rc;
+
+    switch (op) {
+    case OP_RECV_REQUEST:
+        if (res <= 0) {
+            conn_close(ring, c);  // Client went away before finishing its request
+            break;
+        }
+        c->request_len += res;
+        if ((rc = http_parse_request(&req, c->request, c->request_len)) >= 0)
+            dispatch_request(ring, c, &req);
+        else if (rc == HTTP_PARSE_ERROR || c->request_len == sizeof(c->request) - 1)
+            conn_close(ring, c);  // Malformed, or headers too large
+        else
+            submit_op(ring, c, OP_RECV_REQUEST);
+        break;
+
+    case OP_CONNECT:
+        if (res < 0) {
+            // This address refused us; try the next one
+            close(c->serverfd);
+            c->serverfd = -1;
+            c->addr_index++;
+            start_connect(ring, c);
+            break;
+        }
+        c->state = CONN_SEND_REQUEST;
+        submit_op(ring, c, OP_SEND_REQUEST);
+        break;
+
+    case OP_SEND_REQUEST:
+        if (res < 0) {
+            if (c->reused)
+                retry_origin(ring, c);
+            else
+                conn_close(ring, c);
+        } else if ((c->header_off += res) < c->header_len) {
+            submit_op(ring, c, OP_SEND_REQUEST);
+        } else {
+            c->buf_len = c->buf_off = c->held = 0;
+            http_response_init(&c->resp, 0, c->credentials);
+            c->state = CONN_RELAY;
+            submit_op(ring, c, OP_READ_ORIGIN);
+        }
+        break;
+
+    case OP_READ_ORIGIN:
+        if (res <= 0) {
+            if (c->reused && c->total_bytes == 0) {
+                retry_origin(ring, c);  // A pooled connection the origin closed before answering
+            } else if (res < 0) {
+                conn_close(ring, c);
+            } else {
+                c->server_eof = c->server_done = 1;
+                finish_relay(ring, c);
+            }
+            break;
+        }
+        // Relay only this response's bytes and stop where it ends
+        used = http_response_feed(&c->resp, c->buf + c->held, res);
+        append_cache(c, c->buf + c->held, used);
+        c->buf_len = c->held + used;
+        c->buf_off = 0;
+        c->server_done = http_response_complete(&c->resp, 0);
+        if (c->revalidating && hold_response(c)) {
+            if (c->held == MAXBUF)
+                conn_close(ring, c);  // A head too large to hold
+            else
+                submit_op(ring, c, OP_READ_ORIGIN);
+        } else if (c->buf_len == 0 && c->server_done) {
+            finish_relay(ring, c);  // A 304: the stored copy goes out instead
+        } else if (!c->client_gone) {
+            submit_op(ring, c, OP_WRITE_CLIENT);
+        } else if (c->flight->landed) {
+            conn_close(ring, c);  // The followers no longer need it either
+        } else if (c->server_done) {
+            finish_relay(ring, c);
+        } else {
+            submit_op(ring, c, OP_READ_ORIGIN);
+        }
+        break;
+
+    case OP_WRITE_CLIENT:
+        if (res < 0) {
+            if (!c->leader || c->flight->landed) {
+                conn_close(ring, c);
+                break;
+            }
+            c->client_gone = 1;  // Finish the fetch for the followers
+            res = c->buf_len - c->buf_off;
+        }
+        if ((c->buf_off += res) < c->buf_len)
+            submit_op(ring, c, OP_WRITE_CLIENT);
+        else if (c->server_done)
+            finish_relay(ring, c);
+        else
+            submit_op(ring, c, OP_READ_ORIGIN);
+        break;
+
+    case OP_SEND_CACHED:
+        if (res < 0 || (c->cached_off += res) == c->cached->size)
+            conn_close(ring, c);
+        else
+            submit_op(ring, c, OP_SEND_CACHED);
+        break;
+
+    case OP_SEND_FLIGHT:
+        if (res < 0) {
+            conn_close(ring, c);
+        } else {
+            c->cached_off += res;
+            follow(ring, c);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Release everything c holds and close the client's slot through the ring */
+static void conn_close(uring *ring, conn *c) {
+    if (c->serverfd >= 0)
+        close(c->serverfd);
+    if (c->cached)
+        cache_release(c->cached);
+    end_flight(c, 0);
+    if (c->cache_buf)
+        Free(c->cache_buf);
+    c->serverfd = -1;
+    c->cached = NULL;
+    c->cache_buf = NULL;
+    submit_op(ring, c, OP_CLOSE);
+}
+
+/* Serve a complete request from the cache or start fetching it from the origin */
+static void dispatch_request(uring *ring, conn *c, http_request *req) {
+    switch (prepare_request(c, req)) {
+    case REQUEST_CACHED:
+        c->state = CONN_WRITE_CACHED;
+        submit_op(ring, c, OP_SEND_CACHED);
+        break;
+    case REQUEST_ORIGIN:
+        connect_origin(ring, c);
+        break;
+    case REQUEST_FOLLOW:
+        c->state = CONN_FOLLOWING;
+        c->cached_off = 0;
+        follow(ring, c);
+        break;
+    default:
+        conn_close(ring, c);
+        break;
+    }
+}
+
+/* Parked connections were woken: carry on from where each one stopped */
+static void woken(uring *ring) {
+    notice *e, *next;
+
+    for (e = notifier_take(&ring->wakeups); e; e = next) {
+        conn *c = e->data;
+        next = e->next;
+        if (c->state == CONN_FOLLOWING)
+            follow(ring, c);
+        else
+            finish_resolve(ring, c);
+    }
+}
+
+/* CONN_FOLLOWING: send what the flight has published, or wait to be woken for more */
+static void follow(uring *ring, conn *c) {
+    flight *f = c->flight;
+    int landed;
+
+    c->buf_len = flight_poll(f, c->cached_off, &c->wake, &landed);
+    if (c->cached_off < c->buf_len) {
+        submit_op(ring, c, OP_SEND_FLIGHT);
+    } else if (landed) {
+        if (!f->complete && c->cached_off == 0) {
+            end_flight(c, 0);
+            if (refreshed_entry(c)) {
+                c->state = CONN_WRITE_CACHED;
+                submit_op(ring, c, OP_SEND_CACHED);
+            } else {
+                connect_origin(ring, c);  // Not a response to share; fetch it ourselves
+            }
+        } else {
+            conn_close(ring, c);
+        }
+    }
+    // Otherwise nothing is queued for c until the leader publishes more
+}
+
+/* Get a connection to the origin: an idle pooled one if possible, else a new one */
+static void connect_origin(uring *ring, conn *c) {
+    c->header_off = 0;
+    if ((c->serverfd = upstream_take(c->hostname, c->port)) >= 0) {
+        c->reused = 1;
+        c->state = CONN_SEND_REQUEST;
+        submit_op(ring, c, OP_SEND_REQUEST);
+        return;
+    }
+
+    // Look the origin up off this thread unless the DNS cache already knows it
+    c->reused = 0;
+    c->dns.hostname = c->hostname;
+    c->dns.port = c->port;
+    c->dns.addrs = c->addrs;
+    c->dns.notice = &c->wake;
+    c->state = CONN_RESOLVING;
+    if (dns_resolve_async(&c->dns))
+        finish_resolve(ring, c);
+}
+
+/* c's lookup is answered: connect to the first address */
+static void finish_resolve(uring *ring, conn *c) {
+    if (c->dns.error) {
+        fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", c->hostname, c->port, gai_strerror(c->dns.error));
+        conn_close(ring, c);
+        return;
+    }
+    c->addr_index = 0;
+    start_connect(ring, c);
+}
+
+/* A pooled connection died before answering; drop it and fetch over another */
+static void retry_origin(uring *ring, conn *c) {
+    close(c->serverfd);
+    c->serverfd = -1;
+    connect_origin(ring, c);
+}
+
+/* Queue a connect to the first address we can open a socket for */
+static void start_connect(uring *ring, conn *c) {
+    for (; c->addr_index < c->dns.count; c->addr_index++) {
+        dns_addr *a = &c->addrs[c->addr_index];
+        int fd = socket(a->family, a->socktype | SOCK_CLOEXEC, a->protocol);
+        if (fd < 0)
+            continue;
+        c->serverfd = fd;
+        c->state = CONN_CONNECTING;
+        submit_op(ring, c, OP_CONNECT);
+        return;
+    }
+    dns_forget(c->hostname, c->port);  // The origin may have moved; look it up afresh next time
+    printf("Failed to connect to the end server\n");
+    conn_close(ring, c);
+}
+
+/* The response has been relayed: cache it, and pool the origin connection if it can be reused */
+static void finish_relay(uring *ring, conn *c) {
+    int reusable = c->resp.state == RESP_DONE && c->resp.keep_alive && !c->server_eof;
+    int refreshed = revalidated(c);
+
+    // Cache the response if it is complete, within the limit, and allowed
+    // to be reused; a refreshed one is in the cache already
+    int cacheable = !refreshed && http_response_complete(&c->resp, c->server_eof) && c->resp.fresh_until &&
+                    c->cache_buf && c->total_bytes <= MAX_OBJECT_SIZE;
+    if (cacheable)
+        cache_store(c->uri, c->cache_buf, c->total_bytes, c->resp.fresh_until);
+    end_flight(c, cacheable);  // After the store, so misses from now on find it
+
+    if (reusable) {
+        upstream_give(c->hostname, c->port, c->serverfd);
+        c->serverfd = -1;
+    }
+    if (refreshed) {
+        c->state = CONN_WRITE_CACHED;
+        c->cached_off = 0;
+        submit_op(ring, c, OP_SEND_CACHED);
+        return;
+    }
+    conn_close(ring, c);
+}
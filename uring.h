@@ -0,0 +1,46 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <linux/io_uring.h>
+#include "csapp.h"
+#include "reactor.h"
+
+#define URING_ENTRIES 256     // Submission queue entries per ring
+#define URING_MAX_CONNS 256   // Client connections per ring; also fixed file and buffer slots
+
+// Operations in flight; tagged into each submission's user_data with the connection slot
+typedef enum {
+    OP_ACCEPT,         // Multishot accept of client connections into fixed file slots
+    OP_RECV_REQUEST,   // Read the client's request
+    OP_CONNECT,        // Connect to the origin
+    OP_SEND_REQUEST,   // Write the rewritten request to the origin
+    OP_READ_ORIGIN,    // Read the origin's response into the registered buffer
+    OP_WRITE_CLIENT,   // Write the registered buffer to the client
+    OP_SEND_CACHED,    // Write a cache hit to the client
+    OP_SEND_FLIGHT,    // Write what another request's fetch has published to the client
+    OP_CLOSE,          // Close the client's fixed file
+    OP_WAKE            // Read the notifier's eventfd: parked connections have been woken
+} uring_op;
+
+// One io_uring instance with its mapped submission and completion rings
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned pending;            // Queued entries not yet passed to io_uring_enter
+    int fixed_buffers;           // Connection buffers are registered with the ring
+    int accepting;               // A multishot accept is armed
+    int accept_failed;           // Accept failed in a way rearming cannot fix
+    int listenfd;
+    notifier wakeups;            // Where other threads wake this ring's parked connections
+    __u64 wake_count;            // Target of the OP_WAKE eventfd read
+    conn *conns;                 // Indexed by fixed file slot
+} uring;
+
+/* Function Prototypes */
+void uring_run(int listenfd);
+
+#endif /* __URING_H__ */